@@ -9,6 +9,8 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <math.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -16,23 +18,40 @@
 #define MAX_NGRAM_ORDER 3
 #define MAX_SUGGESTIONS 5
 #define MAX_COMMAND_LENGTH 1024
+#define MAX_COMMAND_ARGS 10  // Distinct arguments remembered per command
 #define MAX_HISTORY_SIZE 1000
+#define MAX_HISTORY_ANALYSIS MAX_HISTORY_SIZE
 #define SMOOTHING_FACTOR 0.1
+#define AI_CHECKPOINT_INTERVAL 50  // Learned commands between model snapshots
 
-// N-gram model structure
+// A command that followed a context, and how often it did
 typedef struct {
-    char **context;      // Array of context commands (n-1 commands)
-    char *next_command;  // The command that follows the context
-    int count;           // How many times this sequence was observed
-    double probability;  // Calculated probability
-} NGram;
+    StringId command;
+    int count;
+} NGramSuccessor;
+
+// All n-grams sharing one context, chained in a hash bucket. Contexts of
+// every length from 1 to order-1 are stored so lookups can back off.
+typedef struct NGramContext {
+    StringId context[MAX_NGRAM_ORDER - 1];  // Context commands, oldest first
+    int length;                  // Number of context commands
+    unsigned int hash;           // Hash of the context tuple
+    NGramSuccessor *successors;  // Commands seen after this context
+    int successor_count;
+    int successor_capacity;
+    int total;                   // Sum of successor counts
+    int top[MAX_SUGGESTIONS];    // Successor indices, highest count first
+    int top_count;
+    struct NGramContext *next;   // Next context in the same bucket
+} NGramContext;
 
 typedef struct {
-    NGram *ngrams;       // Array of all n-grams
+    NGramContext **buckets;  // Hash table of contexts
+    int bucket_count;    // Number of buckets (power of two)
+    int context_count;   // Number of contexts in the table
     int size;            // Current number of n-grams
-    int capacity;        // Allocated capacity
     int order;           // N-gram order (2=bigram, 3=trigram, etc.)
-    char **command_history;  // Circular buffer for command history
+    StringId *command_history;  // Circular buffer for command history
     int history_size;    // Current history size
     int history_capacity;// Max history capacity
     int history_index;   // Current position in circular buffer
@@ -41,121 +60,90 @@ typedef struct {
 // Function declarations for n-gram model
 static void init_ngram_model(NGramModel *model, int order);
 static void free_ngram_model(NGramModel *model);
-static void add_to_history(NGramModel *model, const char *command);
-static void train_model(NGramModel *model);
-static void update_ngram(NGramModel *model, const char **context, const char *next_command);
-static char **get_suggestions(NGramModel *model, const char *prev_command, int *count);
-static double calculate_probability(NGramModel *model, const char **context, const char *next_command);
-static void normalize_probabilities(NGramModel *model);
+static void add_to_history(NGramModel *model, StringId command);
+static void update_window(NGramModel *model, int start, int length, int delta);
+static void update_ngram(NGramModel *model, const StringId *context, int length, StringId next_command, int delta);
+static char **get_suggestions(NGramModel *model, StringId prev_command, int *count);
+static int load_snapshot(NGramModel *model, const HistoryLines *resume_from);
+static int save_snapshot(NGramModel *model);
 
 // Global model instance
 static NGramModel ngram_model;
 
-// Context information
-typedef struct {
-    char current_dir[PATH_MAX];
-    time_t timestamp;
-    int hour_of_day;
-    int is_weekend;
-} CommandContext;
+// Commands learned since the last snapshot
+static int unsaved_commands = 0;
+
+// The model is built on first use (or by the idle worker) from the snapshot
+// and the history lines handed over by init_ai_suggest
+static int model_ready = 0;
+static HistoryLines *pending_history = NULL;
+static void build_model();
+
+// Serializes model access between the shell and the suggestion worker
+static pthread_mutex_t ai_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Structure to store command information
 typedef struct {
-    char *command;          // Base command (e.g., 'ls')
-    char **args;            // Common arguments
+    StringId command;       // Base command (e.g., 'ls')
+    StringId *args;         // Common arguments
     int arg_count;          // Number of arguments
     int total_uses;         // Total times used
     time_t last_used;       // When last used
-    char **contexts;        // Common contexts (directories)
+    StringId *contexts;     // Common contexts (directories)
     int context_count;      // Number of contexts
 } CommandInfo;
 
-// Structure to store command sequences
-typedef struct {
-    char *prev_command;
-    char *current_command;
-    CommandContext context;  // Context when command was used
-    int count;              // Frequency
-    time_t last_used;       // Last time this sequence was used
-    float weight;           // Weighted score for sorting
-} CommandSequence;
-
-static CommandSequence *sequences = NULL;
-static int sequence_count = 0;
-static int sequence_capacity = 0;
-
 // Global command info database
 static CommandInfo *command_db = NULL;
 static int command_db_size = 0;
 static int command_db_capacity = 0;
 
-// Current context
-static CommandContext current_context;
+// Index into command_db for each interned string id, -1 if not a command
+static int *command_db_index = NULL;
+static uint32_t command_db_index_size = 0;
 
-// Initialize the current context
-static void update_context() {
-    getcwd(current_context.current_dir, sizeof(current_context.current_dir));
-    time_t now = time(NULL);
-    current_context.timestamp = now;
-    
-    struct tm *timeinfo = localtime(&now);
-    current_context.hour_of_day = timeinfo->tm_hour;
-    current_context.is_weekend = (timeinfo->tm_wday == 0 || timeinfo->tm_wday == 6);
-}
-
-// Calculate similarity between two contexts (0.0 to 1.0)
-static float context_similarity(const CommandContext *a, const CommandContext *b) {
-    float score = 0.0f;
-    
-    // Directory similarity (1.0 if same directory, 0.0 if completely different)
-    if (strcmp(a->current_dir, b->current_dir) == 0) {
-        score += 0.5f;
-    }
-    
-    // Time of day similarity (closer hours get higher scores)
-    int hour_diff = abs(a->hour_of_day - b->hour_of_day);
-    if (hour_diff > 12) hour_diff = 24 - hour_diff;
-    score += (12.0f - hour_diff) / 24.0f * 0.3f;
-    
-    // Weekend/weekday similarity
-    if (a->is_weekend == b->is_weekend) {
-        score += 0.2f;
-    }
-    
-    return score;
-}
+// Fuzzy index over command names (see find_similar_commands)
+static void bk_insert(StringId command);
+static void free_bk_tree();
 
-// Parse a command into its components
-static void parse_command(const char *cmd, char *base_cmd, char **args, int *arg_count) {
+// Parse a command into its interned components
+static void parse_command(const char *cmd, StringId *base_cmd, StringId *args, int *arg_count) {
     char cmd_copy[MAX_COMMAND_LENGTH];
     strncpy(cmd_copy, cmd, sizeof(cmd_copy) - 1);
     cmd_copy[sizeof(cmd_copy) - 1] = '\0';
     
     *arg_count = 0;
+    *base_cmd = NO_STRING;
     char *token = strtok(cmd_copy, " \t\n");
     
     if (token) {
-        strncpy(base_cmd, token, MAX_COMMAND_LENGTH - 1);
-        base_cmd[MAX_COMMAND_LENGTH - 1] = '\0';
+        *base_cmd = intern_string(token);
         
-        while ((token = strtok(NULL, " \t\n")) != NULL && *arg_count < MAX_ARGS - 1) {
-            args[(*arg_count)++] = strdup(token);
+        while ((token = strtok(NULL, " \t\n")) != NULL && *arg_count < MAX_COMMAND_ARGS - 1) {
+            args[(*arg_count)++] = intern_string(token);
         }
     }
-    
-    args[*arg_count] = NULL; // NULL terminate the argument list
 }
 
 // Find or create a command info entry
-static CommandInfo* get_command_info(const char *command) {
+static CommandInfo* get_command_info(StringId command) {
     // First, try to find existing command
-    for (int i = 0; i < command_db_size; i++) {
-        if (strcmp(command_db[i].command, command) == 0) {
-            return &command_db[i];
-        }
+    if (command < command_db_index_size && command_db_index[command] >= 0) {
+        return &command_db[command_db_index[command]];
     }
     
     // Not found, create new entry
+    if (command >= command_db_index_size) {
+        uint32_t new_size = command_db_index_size ? command_db_index_size : 1024;
+        while (new_size <= command) new_size *= 2;
+        command_db_index = realloc(command_db_index, new_size * sizeof(int));
+        for (uint32_t i = command_db_index_size; i < new_size; i++) {
+            command_db_index[i] = -1;
+        }
+        command_db_index_size = new_size;
+    }
+    command_db_index[command] = command_db_size;
+    
     if (command_db_size >= command_db_capacity) {
         command_db_capacity = command_db_capacity ? command_db_capacity * 2 : 16;
         command_db = realloc(command_db, command_db_capacity * sizeof(CommandInfo));
@@ -163,66 +151,75 @@ static CommandInfo* get_command_info(const char *command) {
     
     CommandInfo *info = &command_db[command_db_size++];
     memset(info, 0, sizeof(CommandInfo));
-    info->command = strdup(command);
-    info->args = calloc(MAX_ARGS, sizeof(char*));
-    info->contexts = calloc(16, sizeof(char*)); // Up to 16 different contexts
+    info->command = command;
+    info->args = calloc(MAX_COMMAND_ARGS, sizeof(StringId));
+    info->contexts = calloc(16, sizeof(StringId)); // Up to 16 different contexts
     info->last_used = time(NULL);
+    bk_insert(command);
     
     return info;
 }
 
-// Initialize the AI suggestion system
-void init_ai_suggest() {
+static void train_from_history(HistoryLines *history);
+static void wake_suggestion_worker();
+
+// Initialize the AI suggestion system. Takes ownership of 'history'; the
+// model is only built when it is first needed, or by the worker once idle.
+void init_ai_suggest(HistoryLines *history) {
+    pthread_mutex_lock(&ai_lock);
+    if (model_ready) {
+        train_from_history(history);
+        free_history_lines(history);
+    } else {
+        free_history_lines(pending_history);
+        pending_history = history;
+    }
+    pthread_mutex_unlock(&ai_lock);
+    wake_suggestion_worker();
+}
+
+// Build the model if it isn't yet. Called with ai_lock held.
+static void build_model() {
+    if (model_ready) return;
+    model_ready = 1;  // Training below learns through the model
+    double start = profile_clock();
+    
     // Initialize n-gram model with trigrams (order=3)
     init_ngram_model(&ngram_model, 3);
     
-    // Load command history if available
-    char *home = getenv("HOME");
-    if (home) {
-        char histfile[PATH_MAX];
-        snprintf(histfile, sizeof(histfile), "%s/.myshell_history", home);
-        
-        // Read history file and train model
-        FILE *f = fopen(histfile, "r");
-        if (f) {
-            char line[MAX_COMMAND_LENGTH];
-            while (fgets(line, sizeof(line), f)) {
-                // Remove newline
-                line[strcspn(line, "\n")] = 0;
-                if (strlen(line) > 0) {
-                    add_to_history(&ngram_model, line);
-                }
-            }
-            fclose(f);
-            
-            // Train model on loaded history
-            train_model(&ngram_model);
-        }
+    // Start from the saved model if there is one, then replay only the
+    // history lines it doesn't cover yet
+    load_snapshot(&ngram_model, pending_history);
+    if (pending_history) {
+        train_from_history(pending_history);
+        free_history_lines(pending_history);
+        pending_history = NULL;
     }
+    profile_record("suggestion model (deferred)", start);
 }
 
 // Add a command to the history and update the model
-void add_command_sequence(const char *prev, const char *current) {
+static void learn_command(const char *current) {
     if (!current || strlen(current) == 0 || isspace(current[0])) {
         return;
     }
+    build_model();
+    unsaved_commands++;
     
-    // Add to history
-    add_to_history(&ngram_model, current);
+    StringId current_id = intern_string(current);
     
-    // If we have a previous command, update the model
-    if (prev && strlen(prev) > 0) {
-        train_model(&ngram_model);
-    }
+    // Add to history (updates the affected n-gram counts incrementally)
+    add_to_history(&ngram_model, current_id);
     
-    // Update current context
-    update_context();
+    char dir[PATH_MAX];
+    StringId dir_id = getcwd(dir, sizeof(dir)) ? intern_string(dir) : NO_STRING;
     
     // Parse the current command
-    char base_cmd[MAX_COMMAND_LENGTH];
-    char *args[MAX_ARGS];
+    StringId base_cmd;
+    StringId args[MAX_COMMAND_ARGS];
     int arg_count = 0;
-    parse_command(current, base_cmd, args, &arg_count);
+    parse_command(current, &base_cmd, args, &arg_count);
+    if (base_cmd == NO_STRING) return;
     
     // Update command info
     CommandInfo *cmd_info = get_command_info(base_cmd);
@@ -234,459 +231,1206 @@ void add_command_sequence(const char *prev, const char *current) {
         // Simple check if argument already exists
         int found = 0;
         for (int j = 0; j < cmd_info->arg_count; j++) {
-            if (strcmp(cmd_info->args[j], args[i]) == 0) {
+            if (cmd_info->args[j] == args[i]) {
                 found = 1;
                 break;
             }
         }
         
-        if (!found && cmd_info->arg_count < MAX_ARGS - 1) {
-            cmd_info->args[cmd_info->arg_count++] = strdup(args[i]);
+        if (!found && cmd_info->arg_count < MAX_COMMAND_ARGS - 1) {
+            cmd_info->args[cmd_info->arg_count++] = args[i];
         }
     }
     
     // Add current directory to contexts if not already present
     int context_found = 0;
     for (int i = 0; i < cmd_info->context_count; i++) {
-        if (strcmp(cmd_info->contexts[i], current_context.current_dir) == 0) {
+        if (cmd_info->contexts[i] == dir_id) {
             context_found = 1;
             break;
         }
     }
     
-    if (!context_found && cmd_info->context_count < 15) {
-        cmd_info->contexts[cmd_info->context_count++] = strdup(current_context.current_dir);
+    if (!context_found && dir_id != NO_STRING && cmd_info->context_count < 15) {
+        cmd_info->contexts[cmd_info->context_count++] = dir_id;
     }
-    
-    // Check if this sequence already exists
-    int existing_idx = -1;
-    for (int i = 0; i < sequence_count; i++) {
-        if (strcmp(sequences[i].prev_command, prev) == 0 && 
-            strcmp(sequences[i].current_command, current) == 0) {
-            existing_idx = i;
-            break;
+}
+
+// The n-gram history already follows 'current' from the command before it
+void add_command_sequence(const char *prev, const char *current) {
+    (void)prev;
+    pthread_mutex_lock(&ai_lock);
+    learn_command(current);
+    pthread_mutex_unlock(&ai_lock);
+}
+
+// Edit distance with early cutoff
+//
+// Strings up to 64 characters use Myers' bit-parallel algorithm (Hyyrö's
+// formulation for global edit distance): one column of the DP matrix is a
+// pair of 64-bit delta vectors, so each text character costs a handful of
+// word operations. Longer patterns fall back to a two-row DP on the heap.
+// Both stop as soon as the distance is known to exceed 'max' and then
+// return max + 1.
+
+typedef struct {
+    uint64_t peq[256];   // Bit i set where pattern[i] == character
+    const char *pattern;
+    int length;
+} EditPattern;
+
+static void init_edit_pattern(EditPattern *pat, const char *pattern) {
+    memset(pat->peq, 0, sizeof(pat->peq));
+    pat->pattern = pattern;
+    pat->length = strlen(pattern);
+    if (pat->length <= 64) {
+        for (int i = 0; i < pat->length; i++) {
+            pat->peq[(unsigned char)pattern[i]] |= (uint64_t)1 << i;
         }
     }
+}
+
+static int edit_distance_dp(const char *a, int alen, const char *b, int blen, int max) {
+    int *prev = malloc((blen + 1) * sizeof(int));
+    int *curr = malloc((blen + 1) * sizeof(int));
+    if (!prev || !curr) {
+        free(prev);
+        free(curr);
+        return max + 1;
+    }
     
-    time_t now = time(NULL);
+    for (int j = 0; j <= blen; j++) prev[j] = j;
     
-    if (existing_idx >= 0) {
-        // Update existing sequence
-        sequences[existing_idx].count++;
-        sequences[existing_idx].last_used = now;
-        
-        // Update context (weighted average with existing context)
-        // Learning rate for context updates (commented out as not currently used)
-        // float alpha = 0.3f;
-        sequences[existing_idx].context = current_context;
-    } else {
-        // Add new sequence
-        if (sequence_count >= sequence_capacity) {
-            sequence_capacity = sequence_capacity ? sequence_capacity * 2 : 1;
-            sequences = realloc(sequences, sequence_capacity * sizeof(CommandSequence));
+    int result = max + 1;
+    for (int i = 1; i <= alen; i++) {
+        curr[0] = i;
+        int row_min = curr[0];
+        for (int j = 1; j <= blen; j++) {
+            int cost = (a[i-1] == b[j-1]) ? 0 : 1;
+            int best = prev[j-1] + cost;                       // substitution
+            if (prev[j] + 1 < best) best = prev[j] + 1;        // deletion
+            if (curr[j-1] + 1 < best) best = curr[j-1] + 1;    // insertion
+            curr[j] = best;
+            if (best < row_min) row_min = best;
         }
-        
-        sequences[sequence_count].prev_command = strdup(prev);
-        sequences[sequence_count].current_command = strdup(current);
-        sequences[sequence_count].context = current_context;
-        sequences[sequence_count].count = 1;
-        sequences[sequence_count].last_used = now;
-        sequences[sequence_count].weight = 1.0f;
-        sequence_count++;
+        if (row_min > max) goto done;  // Every later row is at least this
+        int *tmp = prev;
+        prev = curr;
+        curr = tmp;
     }
-}
-
-// Calculate weight for a sequence
-static float calculate_sequence_weight(const CommandSequence *seq) {
-    time_t now = time(NULL);
-    float recency = 1.0f / (1.0f + (now - seq->last_used) / (3600.0f * 24.0f)); // Decay over days
-    float context_score = context_similarity(&seq->context, &current_context);
+    if (prev[blen] <= max) result = prev[blen];
     
-    // Combine factors with weights
-    return (seq->count * 0.5f) + (recency * 0.3f) + (context_score * 0.2f);
+done:
+    free(prev);
+    free(curr);
+    return result;
 }
 
-// Compare function for sorting sequences by weight
-int compare_sequences(const void *a, const void *b) {
-    const CommandSequence *seq_a = (const CommandSequence*)a;
-    const CommandSequence *seq_b = (const CommandSequence*)b;
+static int edit_distance(const EditPattern *pat, const char *text, int max) {
+    int m = pat->length;
+    int n = strlen(text);
+    if (abs(m - n) > max) return max + 1;
+    if (m == 0) return n;
+    if (m > 64) return edit_distance_dp(pat->pattern, m, text, n, max);
     
-    // First compare by weight
-    if (seq_b->weight > seq_a->weight) return 1;
-    if (seq_b->weight < seq_a->weight) return -1;
+    uint64_t high = (uint64_t)1 << (m - 1);
+    uint64_t pv = ~(uint64_t)0;
+    uint64_t mv = 0;
+    int score = m;
+    
+    for (int j = 0; j < n; j++) {
+        uint64_t eq = pat->peq[(unsigned char)text[j]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        
+        if (ph & high) score++;
+        else if (mh & high) score--;
+        
+        // The remaining n-j-1 characters can lower the score by at most one each
+        if (score - (n - j - 1) > max) return max + 1;
+        
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
     
-    // If weights are equal, use count as tiebreaker
-    return seq_b->count - seq_a->count;
+    return score <= max ? score : max + 1;
 }
 
-// Find similar commands using Levenshtein distance
-static int levenshtein_distance(const char *s1, const char *s2) {
-    int len1 = strlen(s1);
-    int len2 = strlen(s2);
-    int dp[len1 + 1][len2 + 1];
+// BK-tree over known command names: a child hangs off the edge labelled
+// with its distance to the parent, so a query within distance k of a node at
+// distance d only has to visit edges d-k..d+k.
+
+#define MAX_TYPO_DISTANCE 2
+
+typedef struct {
+    StringId command;
+    int edge;          // Distance to the parent
+    int first_child;   // Index of the first child, -1 if none
+    int next_sibling;  // Next child of the same parent, -1 if none
+    int max_edge;      // Largest edge among the children
+} BKNode;
+
+static BKNode *bk_nodes = NULL;
+static int bk_size = 0;
+static int bk_capacity = 0;
+
+static void bk_insert(StringId command) {
+    if (bk_size >= bk_capacity) {
+        bk_capacity = bk_capacity ? bk_capacity * 2 : 64;
+        bk_nodes = realloc(bk_nodes, bk_capacity * sizeof(BKNode));
+    }
     
-    for (int i = 0; i <= len1; i++) dp[i][0] = i;
-    for (int j = 0; j <= len2; j++) dp[0][j] = j;
+    BKNode *node = &bk_nodes[bk_size];
+    node->command = command;
+    node->edge = 0;
+    node->first_child = node->next_sibling = -1;
+    node->max_edge = 0;
+    if (bk_size++ == 0) return;
     
-    for (int i = 1; i <= len1; i++) {
-        for (int j = 1; j <= len2; j++) {
-            int cost = (s1[i-1] == s2[j-1]) ? 0 : 1;
-            dp[i][j] = dp[i-1][j-1] + cost; // substitution
-            if (dp[i-1][j] + 1 < dp[i][j]) dp[i][j] = dp[i-1][j] + 1; // deletion
-            if (dp[i][j-1] + 1 < dp[i][j]) dp[i][j] = dp[i][j-1] + 1; // insertion
+    EditPattern pat;
+    init_edit_pattern(&pat, interned_string(command));
+    int index = 0;
+    for (;;) {
+        int d = edit_distance(&pat, interned_string(bk_nodes[index].command), INT_MAX - 1);
+        if (d == 0) {
+            bk_size--;  // Already present
+            return;
         }
+        
+        int child = bk_nodes[index].first_child;
+        while (child != -1 && bk_nodes[child].edge != d) {
+            child = bk_nodes[child].next_sibling;
+        }
+        if (child == -1) {
+            BKNode *added = &bk_nodes[bk_size - 1];
+            added->edge = d;
+            added->next_sibling = bk_nodes[index].first_child;
+            bk_nodes[index].first_child = bk_size - 1;
+            if (d > bk_nodes[index].max_edge) bk_nodes[index].max_edge = d;
+            return;
+        }
+        index = child;
     }
-    
-    return dp[len1][len2];
 }
 
-// Find similar commands in the database
+static void free_bk_tree() {
+    free(bk_nodes);
+    bk_nodes = NULL;
+    bk_size = bk_capacity = 0;
+}
+
+// Find the known commands closest to 'partial', best first
 static char** find_similar_commands(const char *partial, int *count) {
     char **suggestions = malloc(MAX_SUGGESTIONS * sizeof(char*));
-    int scores[MAX_SUGGESTIONS] = {0};
+    int scores[MAX_SUGGESTIONS];
+    int uses[MAX_SUGGESTIONS];
     *count = 0;
+    if (!suggestions || bk_size == 0) return suggestions;
     
-    for (int i = 0; i < command_db_size; i++) {
-        int distance = levenshtein_distance(partial, command_db[i].command);
+    EditPattern pat;
+    init_edit_pattern(&pat, partial);
+    int k = MAX_TYPO_DISTANCE;
+    
+    int *stack = malloc(bk_size * sizeof(int));
+    int top = 0;
+    if (stack) stack[top++] = 0;
+    
+    while (top > 0) {
+        BKNode *node = &bk_nodes[stack[--top]];
         
-        // If this command is a better match than the worst in our current suggestions
-        if (*count < MAX_SUGGESTIONS || distance < scores[MAX_SUGGESTIONS-1]) {
-            // Find position to insert
-            int pos = *count;
-            while (pos > 0 && distance < scores[pos-1]) {
+        // Beyond k + max_edge no child edge can be within k of the distance
+        int d = edit_distance(&pat, interned_string(node->command), k + node->max_edge);
+        
+        if (d <= k) {
+            int node_uses = get_command_info(node->command)->total_uses;
+            
+            // Keep the closest matches, more frequently used ones first
+            int pos = *count < MAX_SUGGESTIONS ? (*count)++ : MAX_SUGGESTIONS;
+            while (pos > 0 && (d < scores[pos-1] ||
+                               (d == scores[pos-1] && node_uses > uses[pos-1]))) {
                 if (pos < MAX_SUGGESTIONS) {
                     scores[pos] = scores[pos-1];
-                    if (suggestions[pos]) free(suggestions[pos]);
+                    uses[pos] = uses[pos-1];
                     suggestions[pos] = suggestions[pos-1];
                 }
                 pos--;
             }
-            
             if (pos < MAX_SUGGESTIONS) {
-                if (suggestions[pos]) free(suggestions[pos]);
-                suggestions[pos] = strdup(command_db[i].command);
-                scores[pos] = distance;
-                if (*count < MAX_SUGGESTIONS) (*count)++;
+                scores[pos] = d;
+                uses[pos] = node_uses;
+                suggestions[pos] = (char *)interned_string(node->command);
+            }
+        }
+        
+        for (int child = node->first_child; child != -1; child = bk_nodes[child].next_sibling) {
+            if (abs(bk_nodes[child].edge - d) <= k) {
+                stack[top++] = child;
             }
         }
     }
+    free(stack);
     
+    for (int i = 0; i < *count; i++) {
+        suggestions[i] = strdup(suggestions[i]);
+    }
     return suggestions;
 }
 
-// Get command suggestions based on previous command
-char **get_command_suggestions(const char *prev_command, int *count) {
-    if (!prev_command) {
-        *count = 0;
+// Known commands that look like a mistyped 'name'. Safe to call from a
+// forked child: if the model is busy it just returns nothing.
+char **suggest_command_corrections(const char *name, int *count) {
+    *count = 0;
+    if (!name || pthread_mutex_trylock(&ai_lock) != 0) return NULL;
+    if (!model_ready) {
+        pthread_mutex_unlock(&ai_lock);
         return NULL;
     }
+    char **suggestions = find_similar_commands(name, count);
+    pthread_mutex_unlock(&ai_lock);
     
-    return get_suggestions(&ngram_model, prev_command, count);
-    
-    // First pass: calculate weights for all matching sequences
-    for (int i = 0; i < sequence_count; i++) {
-        if (strcmp(sequences[i].prev_command, prev_command) == 0) {
-            sequences[i].weight = calculate_sequence_weight(&sequences[i]);
+    // The typo itself may have been learned already
+    int kept = 0;
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(suggestions[i], name) == 0) {
+            free(suggestions[i]);
+        } else {
+            suggestions[kept++] = suggestions[i];
         }
     }
+    *count = kept;
     
-    // Count matching sequences
-    int match_count = 0;
-    for (int i = 0; i < sequence_count; i++) {
-        if (strcmp(sequences[i].prev_command, prev_command) == 0) {
-            match_count++;
-        }
+    if (*count == 0) {
+        free(suggestions);
+        return NULL;
     }
-    
-    if (match_count == 0) {
-        return find_similar_commands(prev_command, count);
+    return suggestions;
+}
+
+// Get command suggestions based on previous command
+static char **compute_suggestions(const char *prev_command, int *count) {
+    // Commands that were never interned can't have been learned
+    StringId prev_id = intern_lookup(prev_command);
+    if (prev_id == NO_STRING) {
+        *count = 0;
+        return NULL;
     }
     
-    // Allocate array for matching sequences
-    CommandSequence *matches = malloc(match_count * sizeof(CommandSequence));
-    int match_index = 0;
-    
-    // Copy matching sequences
-    for (int i = 0; i < sequence_count; i++) {
-        if (strcmp(sequences[i].prev_command, prev_command) == 0) {
-            matches[match_index++] = sequences[i];
+    return get_suggestions(&ngram_model, prev_id, count);
+}
+
+char **get_command_suggestions(const char *prev_command, int *count) {
+    pthread_mutex_lock(&ai_lock);
+    build_model();
+    char **suggestions = compute_suggestions(prev_command, count);
+    pthread_mutex_unlock(&ai_lock);
+    return suggestions;
+}
+
+// Background suggestion worker
+//
+// The shell posts a request as soon as it dispatches a command and the
+// worker computes the suggestions while the command runs. Each request has a
+// generation number; a result is only handed out if it belongs to the latest
+// request, so anything cancelled or superseded is dropped. With no request
+// pending, the worker builds the model as soon as there is history for it.
+
+static pthread_t worker_thread;
+static int worker_running = 0;
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;   // New request
+static pthread_cond_t result_cond = PTHREAD_COND_INITIALIZER;   // New result
+static char *request_command = NULL;     // Pending request, owned by the worker lock
+static unsigned int request_gen = 0;     // Generation of the latest request
+static char **result_suggestions = NULL;
+static int result_count = 0;
+static unsigned int result_gen = 0;      // Generation the result belongs to
+static int worker_stop = 0;
+static int worker_build = 0;             // Build the model when idle
+
+static void free_suggestion_list(char **suggestions, int count) {
+    for (int i = 0; i < count; i++) {
+        free(suggestions[i]);
+    }
+    free(suggestions);
+}
+
+static void *suggestion_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&worker_lock);
+    while (!worker_stop) {
+        if (!request_command && worker_build) {
+            worker_build = 0;
+            pthread_mutex_unlock(&worker_lock);
+            pthread_mutex_lock(&ai_lock);
+            build_model();
+            pthread_mutex_unlock(&ai_lock);
+            pthread_mutex_lock(&worker_lock);
+            continue;
+        }
+        if (!request_command) {
+            pthread_cond_wait(&worker_cond, &worker_lock);
+            continue;
+        }
+        
+        char *command = request_command;
+        unsigned int gen = request_gen;
+        request_command = NULL;
+        pthread_mutex_unlock(&worker_lock);
+        
+        int count = 0;
+        char **suggestions = get_command_suggestions(command, &count);
+        free(command);
+        
+        pthread_mutex_lock(&worker_lock);
+        if (gen == request_gen) {
+            free_suggestion_list(result_suggestions, result_count);
+            result_suggestions = suggestions;
+            result_count = count;
+            result_gen = gen;
+            pthread_cond_broadcast(&result_cond);
+        } else {
+            free_suggestion_list(suggestions, count);  // Stale
         }
     }
+    pthread_mutex_unlock(&worker_lock);
+    return NULL;
+}
+
+void start_suggestion_worker() {
+    if (worker_running) return;
+    worker_stop = 0;
+    if (pthread_create(&worker_thread, NULL, suggestion_worker, NULL) == 0) {
+        worker_running = 1;
+    }
+}
+
+// Let the worker build the model in the background
+static void wake_suggestion_worker() {
+    pthread_mutex_lock(&worker_lock);
+    worker_build = 1;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_lock);
+}
+
+// Ask for suggestions following 'prev_command'; supersedes older requests
+void request_command_suggestions(const char *prev_command) {
+    pthread_mutex_lock(&worker_lock);
+    request_gen++;
+    free(request_command);
+    request_command = strdup(prev_command);
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_lock);
     
-    // Sort by weight
-    qsort(matches, match_count, sizeof(CommandSequence), compare_sequences);
-    
-    // Limit number of suggestions
-    int suggestion_count = (match_count < MAX_SUGGESTIONS) ? match_count : MAX_SUGGESTIONS;
-    char **suggestions = malloc((suggestion_count + 1) * sizeof(char*));
+    // Without a worker, compute in place so callers still get a result
+    if (!worker_running) {
+        int count = 0;
+        char **suggestions = get_command_suggestions(prev_command, &count);
+        pthread_mutex_lock(&worker_lock);
+        free(request_command);
+        request_command = NULL;
+        free_suggestion_list(result_suggestions, result_count);
+        result_suggestions = suggestions;
+        result_count = count;
+        result_gen = request_gen;
+        pthread_mutex_unlock(&worker_lock);
+    }
+}
+
+// Take the result of the latest request, waiting at most timeout_ms for it.
+// Returns 1 with the (possibly empty) suggestions once the result is ready,
+// 0 if it isn't ready yet.
+int take_command_suggestions(int timeout_ms, char ***suggestions, int *count) {
+    int ready = 0;
+    *suggestions = NULL;
+    *count = 0;
     
-    // Copy suggestions and add context information
-    for (int i = 0; i < suggestion_count; i++) {
-        // Add context hints to suggestions
-        char context_hint[256] = "";
-        if (strcmp(matches[i].context.current_dir, current_context.current_dir) != 0) {
-            // If the command is usually used in a different directory, show the directory
-            snprintf(context_hint, sizeof(context_hint), " (in %s)", 
-                    basename(matches[i].context.current_dir));
+    pthread_mutex_lock(&worker_lock);
+    if (timeout_ms > 0 && result_gen != request_gen) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (result_gen != request_gen &&
+               pthread_cond_timedwait(&result_cond, &worker_lock, &deadline) == 0) {
         }
-        
-        // Allocate space for the suggestion + context hint + null terminator
-        suggestions[i] = malloc(strlen(matches[i].current_command) + strlen(context_hint) + 1);
-        sprintf(suggestions[i], "%s%s", matches[i].current_command, context_hint);
     }
-    suggestions[suggestion_count] = NULL;
-    
-    free(matches);
-    *count = suggestion_count;
-    return suggestions;
+    if (result_gen == request_gen) {
+        ready = 1;
+        *suggestions = result_suggestions;
+        *count = result_count;
+        result_suggestions = NULL;
+        result_count = 0;
+    }
+    pthread_mutex_unlock(&worker_lock);
+    return ready;
 }
 
-// Free resources used by the AI suggestion system
+// Drop the pending request and any result not taken yet
+void cancel_command_suggestions() {
+    pthread_mutex_lock(&worker_lock);
+    request_gen++;
+    free(request_command);
+    request_command = NULL;
+    free_suggestion_list(result_suggestions, result_count);
+    result_suggestions = NULL;
+    result_count = 0;
+    result_gen = request_gen;
+    pthread_mutex_unlock(&worker_lock);
+}
+
+static void stop_suggestion_worker() {
+    if (!worker_running) return;
+    pthread_mutex_lock(&worker_lock);
+    worker_stop = 1;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_lock);
+    pthread_join(worker_thread, NULL);
+    worker_running = 0;
+    cancel_command_suggestions();
+}
+
+// Free resources used by the AI suggestion system. The model lives for the
+// whole session; this is only called on shutdown.
 void free_ai_suggest() {
+    stop_suggestion_worker();
     free_ngram_model(&ngram_model);
+    free_history_lines(pending_history);
+    pending_history = NULL;
+    model_ready = 0;
+    
+    for (int i = 0; i < command_db_size; i++) {
+        free(command_db[i].args);
+        free(command_db[i].contexts);
+    }
+    free(command_db);
+    free(command_db_index);
+    command_db = NULL;
+    command_db_index = NULL;
+    command_db_size = command_db_capacity = 0;
+    command_db_index_size = 0;
+    free_bk_tree();
+    
+    // Must come last: snapshot strings are mapped until this point
+    free_interned_strings();
 }
 
 // N-gram model implementation
 static void init_ngram_model(NGramModel *model, int order) {
     memset(model, 0, sizeof(NGramModel));
     model->order = order > MAX_NGRAM_ORDER ? MAX_NGRAM_ORDER : order;
-    model->capacity = 1024;
-    model->ngrams = calloc(model->capacity, sizeof(NGram));
+    model->bucket_count = 1024;
+    model->buckets = calloc(model->bucket_count, sizeof(NGramContext *));
     
     // Initialize command history circular buffer
     model->history_capacity = MAX_HISTORY_SIZE;
-    model->command_history = calloc(model->history_capacity, sizeof(char *));
+    model->command_history = calloc(model->history_capacity, sizeof(StringId));
     model->history_size = 0;
     model->history_index = 0;
 }
 
+static void free_context(NGramContext *ctx) {
+    free(ctx->successors);
+    free(ctx);
+}
+
 static void free_ngram_model(NGramModel *model) {
     if (!model) return;
     
-    // Free n-grams
-    for (int i = 0; i < model->size; i++) {
-        free(model->ngrams[i].context);
-        free(model->ngrams[i].next_command);
+    // Free contexts and their n-grams
+    for (int b = 0; b < model->bucket_count; b++) {
+        NGramContext *ctx = model->buckets[b];
+        while (ctx) {
+            NGramContext *next = ctx->next;
+            free_context(ctx);
+            ctx = next;
+        }
     }
-    free(model->ngrams);
+    free(model->buckets);
     
-    // Free command history
-    for (int i = 0; i < model->history_size; i++) {
-        free(model->command_history[i]);
-    }
+    // Free command history (the strings belong to the intern table)
     free(model->command_history);
     
     memset(model, 0, sizeof(NGramModel));
 }
 
-static void add_to_history(NGramModel *model, const char *command) {
-    if (!model || !command || strlen(command) == 0) return;
+// Command at logical position i of the circular buffer (0 = oldest)
+static StringId history_at(NGramModel *model, int i) {
+    int idx = (model->history_index - model->history_size + i + model->history_capacity) % model->history_capacity;
+    return model->command_history[idx];
+}
+
+static void add_to_history(NGramModel *model, StringId command) {
+    if (!model || command == NO_STRING) return;
     
-    // Free old command if we're overwriting
-    if (model->command_history[model->history_index]) {
-        free(model->command_history[model->history_index]);
+    // Forget the n-grams that start at the oldest command before it is evicted
+    if (model->history_size == model->history_capacity) {
+        for (int len = 1; len < model->order; len++) {
+            update_window(model, 0, len, -1);
+        }
     }
     
-    // Add new command
-    model->command_history[model->history_index] = strdup(command);
+    // Add new command, overwriting the oldest one when full
+    model->command_history[model->history_index] = command;
     
     // Update indices
     model->history_index = (model->history_index + 1) % model->history_capacity;
     if (model->history_size < model->history_capacity) {
         model->history_size++;
     }
+    
+    // Learn the n-grams that end at the new command
+    for (int len = 1; len < model->order; len++) {
+        update_window(model, model->history_size - 1 - len, len, 1);
+    }
 }
 
-static void train_model(NGramModel *model) {
-    if (model->history_size < 2) return;  // Need at least 2 commands to learn
+// Add (delta=1) or remove (delta=-1) the n-gram whose context of 'length'
+// commands starts at logical history position 'start'. Windows that don't
+// fit in the history are ignored.
+static void update_window(NGramModel *model, int start, int length, int delta) {
+    if (start < 0 || start + length >= model->history_size) return;
     
-    // Reset model
-    model->size = 0;
-    
-    // Generate n-grams from history
-    for (int i = model->order - 1; i < model->history_size; i++) {
-        // Create context (n-1 previous commands)
-        const char *context[model->order - 1];
-        for (int j = 0; j < model->order - 1; j++) {
-            int idx = (model->history_index - model->history_size + i - j - 1 + model->history_capacity) % model->history_capacity;
-            context[model->order - 2 - j] = model->command_history[idx];
-        }
-        
-        // Get next command
-        int next_idx = (model->history_index - model->history_size + i) % model->history_capacity;
-        const char *next_cmd = model->command_history[next_idx];
-        
-        // Update n-gram counts
-        update_ngram(model, context, next_cmd);
+    StringId context[MAX_NGRAM_ORDER - 1];
+    for (int j = 0; j < length; j++) {
+        context[j] = history_at(model, start + j);
     }
-    
-    // Calculate probabilities
-    normalize_probabilities(model);
+    update_ngram(model, context, length, history_at(model, start + length), delta);
 }
 
-static void update_ngram(NGramModel *model, const char **context, const char *next_command) {
-    if (!model || !next_command) return;
-    
-    // Check if this n-gram already exists
-    for (int i = 0; i < model->size; i++) {
-        int match = 1;
+// Multiplicative hash over the context's string ids
+static unsigned int hash_context(const StringId *context, int length) {
+    unsigned int h = (unsigned int)length;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ context[i]) * 2654435761u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static NGramContext *find_context(NGramModel *model, const StringId *context, int length, unsigned int hash) {
+    for (NGramContext *ctx = model->buckets[hash & (model->bucket_count - 1)]; ctx; ctx = ctx->next) {
+        if (ctx->hash != hash || ctx->length != length) continue;
         
-        // Check context matches
-        for (int j = 0; j < model->order - 1; j++) {
-            if (!context[j] || !model->ngrams[i].context[j] || 
-                strcmp(context[j], model->ngrams[i].context[j]) != 0) {
+        int match = 1;
+        for (int i = 0; i < length; i++) {
+            if (ctx->context[i] != context[i]) {
                 match = 0;
                 break;
             }
         }
-        
-        // Check next command matches
-        if (match && model->ngrams[i].next_command && 
-            strcmp(next_command, model->ngrams[i].next_command) == 0) {
-            model->ngrams[i].count++;
+        if (match) return ctx;
+    }
+    return NULL;
+}
+
+static void grow_buckets(NGramModel *model) {
+    int new_count = model->bucket_count * 2;
+    NGramContext **buckets = calloc(new_count, sizeof(NGramContext *));
+    if (!buckets) return;
+    
+    for (int b = 0; b < model->bucket_count; b++) {
+        NGramContext *ctx = model->buckets[b];
+        while (ctx) {
+            NGramContext *next = ctx->next;
+            ctx->next = buckets[ctx->hash & (new_count - 1)];
+            buckets[ctx->hash & (new_count - 1)] = ctx;
+            ctx = next;
+        }
+    }
+    free(model->buckets);
+    model->buckets = buckets;
+    model->bucket_count = new_count;
+}
+
+static NGramContext *add_context(NGramModel *model, const StringId *context, int length, unsigned int hash) {
+    if (model->context_count >= model->bucket_count) {
+        grow_buckets(model);
+    }
+    
+    NGramContext *ctx = calloc(1, sizeof(NGramContext));
+    memcpy(ctx->context, context, length * sizeof(StringId));
+    ctx->length = length;
+    ctx->hash = hash;
+    
+    int b = hash & (model->bucket_count - 1);
+    ctx->next = model->buckets[b];
+    model->buckets[b] = ctx;
+    model->context_count++;
+    return ctx;
+}
+
+static void remove_context(NGramModel *model, NGramContext *ctx) {
+    NGramContext **link = &model->buckets[ctx->hash & (model->bucket_count - 1)];
+    while (*link != ctx) {
+        link = &(*link)->next;
+    }
+    *link = ctx->next;
+    model->context_count--;
+    free_context(ctx);
+}
+
+// Rebuild a context's top-k list from all of its successors
+static void rebuild_top(NGramContext *ctx) {
+    ctx->top_count = 0;
+    for (int i = 0; i < ctx->successor_count; i++) {
+        int count = ctx->successors[i].count;
+        int pos = ctx->top_count < MAX_SUGGESTIONS ? ctx->top_count++ : MAX_SUGGESTIONS;
+        while (pos > 0 && ctx->successors[ctx->top[pos - 1]].count < count) {
+            if (pos < MAX_SUGGESTIONS) ctx->top[pos] = ctx->top[pos - 1];
+            pos--;
+        }
+        if (pos < MAX_SUGGESTIONS) ctx->top[pos] = i;
+    }
+}
+
+// Keep the top-k list sorted after successor 'index' was incremented
+static void promote_top(NGramContext *ctx, int index) {
+    int count = ctx->successors[index].count;
+    int pos = 0;
+    while (pos < ctx->top_count && ctx->top[pos] != index) pos++;
+    
+    if (pos == ctx->top_count) {
+        // Not in the list yet: take a free slot or beat the weakest entry
+        if (ctx->top_count < MAX_SUGGESTIONS) {
+            ctx->top_count++;
+        } else if (ctx->successors[ctx->top[MAX_SUGGESTIONS - 1]].count < count) {
+            pos = MAX_SUGGESTIONS - 1;
+        } else {
             return;
         }
     }
     
-    // Add new n-gram if not found
-    if (model->size >= model->capacity) {
-        model->capacity *= 2;
-        model->ngrams = realloc(model->ngrams, model->capacity * sizeof(NGram));
+    while (pos > 0 && ctx->successors[ctx->top[pos - 1]].count < count) {
+        ctx->top[pos] = ctx->top[pos - 1];
+        pos--;
+    }
+    ctx->top[pos] = index;
+}
+
+static void update_ngram(NGramModel *model, const StringId *context, int length, StringId next_command, int delta) {
+    if (!model || next_command == NO_STRING || length <= 0) return;
+    
+    unsigned int hash = hash_context(context, length);
+    NGramContext *ctx = find_context(model, context, length, hash);
+    if (!ctx) {
+        if (delta <= 0) return;
+        ctx = add_context(model, context, length, hash);
     }
     
-    // Initialize new n-gram
-    NGram *ngram = &model->ngrams[model->size];
-    ngram->context = calloc(model->order - 1, sizeof(char *));
+    // Check if this n-gram already exists
+    int index = -1;
+    for (int i = 0; i < ctx->successor_count; i++) {
+        if (ctx->successors[i].command == next_command) {
+            index = i;
+            break;
+        }
+    }
     
-    // Copy context
-    for (int i = 0; i < model->order - 1; i++) {
-        if (context[i]) {
-            ngram->context[i] = strdup(context[i]);
+    if (index < 0) {
+        if (delta <= 0) return;
+        
+        // Add new n-gram if not found
+        if (ctx->successor_count >= ctx->successor_capacity) {
+            ctx->successor_capacity = ctx->successor_capacity ? ctx->successor_capacity * 2 : 4;
+            ctx->successors = realloc(ctx->successors, ctx->successor_capacity * sizeof(NGramSuccessor));
         }
+        index = ctx->successor_count++;
+        ctx->successors[index].command = next_command;
+        ctx->successors[index].count = 0;
+        model->size++;
     }
     
-    // Copy next command
-    ngram->next_command = strdup(next_command);
-    ngram->count = 1;
-    ngram->probability = 0.0;
+    ctx->successors[index].count += delta;
+    ctx->total += delta;
+    
+    if (delta > 0) {
+        promote_top(ctx, index);
+        return;
+    }
     
-    model->size++;
+    // Drop n-grams (and contexts) that are no longer in the history window
+    if (ctx->successors[index].count <= 0) {
+        ctx->successors[index] = ctx->successors[--ctx->successor_count];
+        model->size--;
+    }
+    if (ctx->successor_count == 0) {
+        remove_context(model, ctx);
+        return;
+    }
+    rebuild_top(ctx);
 }
 
-static char **get_suggestions(NGramModel *model, const char *prev_command, int *count) {
-    if (!model || !prev_command || model->size == 0) {
-        *count = 0;
+static char **get_suggestions(NGramModel *model, StringId prev_command, int *count) {
+    *count = 0;
+    if (!model || prev_command == NO_STRING || model->size == 0) {
         return NULL;
     }
     
-    // Allocate array for suggestions
-    char **suggestions = calloc(MAX_SUGGESTIONS, sizeof(char *));
-    double scores[MAX_SUGGESTIONS] = {0};
-    *count = 0;
+    // Use the longest context available from recent history, backing off
+    // to just the previous command
+    StringId context[MAX_NGRAM_ORDER - 1];
+    NGramContext *ctx = NULL;
+    int last = model->history_size - 1;
+    int recent = last >= 0 && history_at(model, last) == prev_command;
     
-    // Find matching n-grams
-    for (int i = 0; i < model->size; i++) {
-        // For bigram model (order=2), just check the previous command
-        if (model->order >= 2 && model->ngrams[i].context[0] && 
-            strcmp(model->ngrams[i].context[0], prev_command) == 0) {
-            
-            // Check if this is one of the top suggestions
-            double score = model->ngrams[i].probability;
-            
-            // Apply recency bonus if available
-            if (model->history_size > 0) {
-                int last_idx = (model->history_index - 1 + model->history_capacity) % model->history_capacity;
-                if (strcmp(model->command_history[last_idx], model->ngrams[i].next_command) == 0) {
-                    score *= 1.5;  // Boost recent commands
-                }
-            }
-            
-            // Insert in sorted order
-            for (int j = 0; j < MAX_SUGGESTIONS; j++) {
-                if (score > scores[j]) {
-                    // Shift existing suggestions down
-                    for (int k = MAX_SUGGESTIONS - 1; k > j; k--) {
-                        if (suggestions[k-1]) {
-                            free(suggestions[k]);
-                            suggestions[k] = strdup(suggestions[k-1]);
-                            scores[k] = scores[k-1];
-                        }
-                    }
-                    
-                    // Insert new suggestion
-                    if (suggestions[j]) {
-                        free(suggestions[j]);
-                    }
-                    suggestions[j] = strdup(model->ngrams[i].next_command);
-                    scores[j] = score;
-                    
-                    if (*count < MAX_SUGGESTIONS) {
-                        (*count)++;
-                    }
-                    break;
-                }
-            }
+    for (int len = model->order - 1; len >= 1 && !ctx; len--) {
+        if (len > 1 && (!recent || len > model->history_size)) continue;
+        for (int j = 0; j < len - 1; j++) {
+            context[j] = history_at(model, last - len + 1 + j);
+        }
+        context[len - 1] = prev_command;
+        ctx = find_context(model, context, len, hash_context(context, len));
+    }
+    if (!ctx) return NULL;
+    
+    // Score the precomputed top-k successors
+    char **suggestions = calloc(MAX_SUGGESTIONS, sizeof(char *));
+    double scores[MAX_SUGGESTIONS];
+    for (int i = 0; i < ctx->top_count; i++) {
+        NGramSuccessor *succ = &ctx->successors[ctx->top[i]];
+        
+        // Probability with add-k smoothing
+        double score = (succ->count + SMOOTHING_FACTOR) /
+                       (ctx->total + SMOOTHING_FACTOR * ctx->successor_count);
+        
+        // Apply recency bonus if available
+        if (last >= 0 && history_at(model, last) == succ->command) {
+            score *= 1.5;  // Boost recent commands
         }
+        
+        // Insert in sorted order
+        int pos = (*count)++;
+        while (pos > 0 && scores[pos - 1] < score) {
+            scores[pos] = scores[pos - 1];
+            suggestions[pos] = suggestions[pos - 1];
+            pos--;
+        }
+        scores[pos] = score;
+        suggestions[pos] = strdup(interned_string(succ->command));
     }
     
     return suggestions;
 }
 
-static void normalize_probabilities(NGramModel *model) {
-    // First pass: calculate total counts for each context
-    for (int i = 0; i < model->size; i++) {
-        double total = 0;
-        
-        // Find all n-grams with the same context
-        for (int j = 0; j < model->size; j++) {
-            int match = 1;
-            
-            for (int k = 0; k < model->order - 1; k++) {
-                if ((!model->ngrams[i].context[k] && model->ngrams[j].context[k]) ||
-                    (model->ngrams[i].context[k] && !model->ngrams[j].context[k]) ||
-                    (model->ngrams[i].context[k] && model->ngrams[j].context[k] &&
-                     strcmp(model->ngrams[i].context[k], model->ngrams[j].context[k]) != 0)) {
-                    match = 0;
-                    break;
-                }
+// Model snapshot
+//
+// The trained model is saved to ~/.myshell_model so startup doesn't have to
+// retrain from the whole history. The file is mmap'd on load: the interned
+// strings are used in place, the other sections are small fixed-size records.
+// Everything is native-endian; a different magic/version/layout is rejected
+// and the model is retrained from history instead.
+
+#define SNAPSHOT_FILE ".myshell_model"
+#define SNAPSHOT_MAGIC "MSHMODEL"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_MAX_CONTEXTS 16
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint32_t history_capacity;
+    uint32_t string_count;
+    uint32_t history_count;     // History ids, oldest first
+    uint32_t ngram_count;
+    uint32_t command_count;
+    uint32_t reserved;
+    uint64_t history_inode;     // History file and offset the model has learned up to
+    uint64_t history_offset;
+    uint64_t string_offsets;    // uint32_t per string, relative to string_data
+    uint64_t string_hashes;     // uint32_t per string
+    uint64_t string_data;       // NUL-terminated strings
+    uint64_t string_data_size;
+    uint64_t history;           // StringId per history entry
+    uint64_t ngrams;            // SnapshotNGram records
+    uint64_t commands;          // SnapshotCommand records
+    uint64_t file_size;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t length;
+    StringId context[MAX_NGRAM_ORDER - 1];
+    StringId next_command;
+    int32_t count;
+} SnapshotNGram;
+
+typedef struct {
+    StringId command;
+    int32_t total_uses;
+    int64_t last_used;
+    int32_t arg_count;
+    int32_t context_count;
+    StringId args[MAX_COMMAND_ARGS];
+    StringId contexts[SNAPSHOT_MAX_CONTEXTS];
+} SnapshotCommand;
+
+// History file position the loaded or last saved snapshot covers; inode 0
+// if there is none
+static uint64_t snapshot_history_inode = 0;
+static uint64_t snapshot_history_offset = 0;
+
+static char *get_snapshot_path() {
+    static char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    if (!home) return NULL;
+    snprintf(path, sizeof(path), "%s/%s", home, SNAPSHOT_FILE);
+    return path;
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Map a snapshot and load it into the (empty) model and intern table.
+// 'resume_from' is the history it will be resumed from, if already read.
+// Returns 0 on success; on failure nothing has been loaded.
+static int load_snapshot(NGramModel *model, const HistoryLines *resume_from) {
+    const char *path = get_snapshot_path();
+    if (!path) return -1;
+    
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return -1;
+    }
+    
+    size_t size = st.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    
+    const SnapshotHeader *hdr = (const SnapshotHeader *)base;
+    int ok = memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) == 0 &&
+             hdr->version == SNAPSHOT_VERSION &&
+             hdr->order == (uint32_t)model->order &&
+             hdr->history_capacity == (uint32_t)model->history_capacity &&
+             hdr->file_size == size &&
+             hdr->history_count <= hdr->history_capacity &&
+             hdr->string_offsets + (uint64_t)hdr->string_count * sizeof(uint32_t) <= size &&
+             hdr->string_hashes + (uint64_t)hdr->string_count * sizeof(uint32_t) <= size &&
+             hdr->string_data + hdr->string_data_size <= size &&
+             hdr->history + (uint64_t)hdr->history_count * sizeof(StringId) <= size &&
+             hdr->ngrams + (uint64_t)hdr->ngram_count * sizeof(SnapshotNGram) <= size &&
+             hdr->commands + (uint64_t)hdr->command_count * sizeof(SnapshotCommand) <= size &&
+             (hdr->string_data_size == 0 || base[hdr->string_data + hdr->string_data_size - 1] == '\0');
+    
+    const uint32_t *offsets = (const uint32_t *)(base + hdr->string_offsets);
+    const StringId *history = (const StringId *)(base + hdr->history);
+    const SnapshotNGram *ngrams = (const SnapshotNGram *)(base + hdr->ngrams);
+    const SnapshotCommand *commands = (const SnapshotCommand *)(base + hdr->commands);
+    
+    // Reject out-of-range references before anything is adopted
+    for (uint32_t i = 0; ok && i < hdr->string_count; i++) {
+        ok = offsets[i] < hdr->string_data_size;
+    }
+    for (uint32_t i = 0; ok && i < hdr->history_count; i++) {
+        ok = history[i] < hdr->string_count;
+    }
+    for (uint32_t i = 0; ok && i < hdr->ngram_count; i++) {
+        ok = ngrams[i].length >= 1 && ngrams[i].length < hdr->order &&
+             ngrams[i].count > 0 && ngrams[i].next_command < hdr->string_count;
+        for (uint32_t j = 0; ok && j < ngrams[i].length; j++) {
+            ok = ngrams[i].context[j] < hdr->string_count;
+        }
+    }
+    for (uint32_t i = 0; ok && i < hdr->command_count; i++) {
+        ok = commands[i].command < hdr->string_count &&
+             commands[i].arg_count >= 0 && commands[i].arg_count < MAX_COMMAND_ARGS &&
+             commands[i].context_count >= 0 && commands[i].context_count < SNAPSHOT_MAX_CONTEXTS;
+        for (int j = 0; ok && j < commands[i].arg_count; j++) {
+            ok = commands[i].args[j] < hdr->string_count;
+        }
+        for (int j = 0; ok && j < commands[i].context_count; j++) {
+            ok = commands[i].contexts[j] < hdr->string_count;
+        }
+    }
+    // A snapshot taken before the history file was compacted (or replaced)
+    // can't say which of its lines are new: retrain from the file instead
+    ok = ok && (!resume_from || hdr->history_inode == resume_from->inode);
+    
+    if (!ok || intern_adopt(base + hdr->string_data, offsets,
+                            (const uint32_t *)(base + hdr->string_hashes),
+                            hdr->string_count, base, size) != 0) {
+        munmap(base, size);
+        return -1;
+    }
+    
+    // Restore the history ring as-is; its n-grams come from the saved counts
+    for (uint32_t i = 0; i < hdr->history_count; i++) {
+        model->command_history[i] = history[i];
+    }
+    model->history_size = hdr->history_count;
+    model->history_index = hdr->history_count % model->history_capacity;
+    
+    for (uint32_t i = 0; i < hdr->ngram_count; i++) {
+        update_ngram(model, ngrams[i].context, ngrams[i].length,
+                     ngrams[i].next_command, ngrams[i].count);
+    }
+    
+    for (uint32_t i = 0; i < hdr->command_count; i++) {
+        CommandInfo *info = get_command_info(commands[i].command);
+        info->total_uses = commands[i].total_uses;
+        info->last_used = commands[i].last_used;
+        info->arg_count = commands[i].arg_count;
+        memcpy(info->args, commands[i].args, commands[i].arg_count * sizeof(StringId));
+        info->context_count = commands[i].context_count;
+        memcpy(info->contexts, commands[i].contexts, commands[i].context_count * sizeof(StringId));
+    }
+    
+    snapshot_history_inode = hdr->history_inode;
+    snapshot_history_offset = hdr->history_offset;
+    return 0;
+}
+
+static int write_all(FILE *f, const void *data, size_t size, uint64_t *offset) {
+    if (size && fwrite(data, 1, size, f) != size) return -1;
+    *offset += size;
+    return 0;
+}
+
+static int pad_to(FILE *f, uint64_t target, uint64_t *offset) {
+    static const char zeros[8] = {0};
+    return write_all(f, zeros, target - *offset, offset);
+}
+
+// Mark a string the snapshot has to keep
+static void keep_string(StringId *snapshot_id, StringId id) {
+    if (id != NO_STRING) snapshot_id[id] = 0;
+}
+
+// A string's id in the snapshot being written
+static StringId snapshot_string(const StringId *snapshot_id, StringId id) {
+    return id == NO_STRING ? NO_STRING : snapshot_id[id];
+}
+
+// Write the model to a temporary file and rename it over the snapshot
+static int save_snapshot(NGramModel *model) {
+    const char *path = get_snapshot_path();
+    if (!path || !model->command_history) return -1;
+    
+    // Remember how much of the history file the model covers; a shell that
+    // never touched the file keeps the position it loaded
+    SnapshotHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (get_history_position(&hdr.history_inode, &hdr.history_offset) == -1) {
+        hdr.history_inode = snapshot_history_inode;
+        hdr.history_offset = snapshot_history_offset;
+    }
+    
+    // Only the strings the model still references are saved, renumbered
+    // densely in id order: commands seen once and since forgotten would
+    // otherwise be carried from snapshot to snapshot forever
+    uint32_t interned = interned_count();
+    StringId *snapshot_id = malloc((interned + 1) * sizeof(StringId));
+    StringId *saved = malloc((interned + 1) * sizeof(StringId));
+    if (!snapshot_id || !saved) {
+        free(snapshot_id);
+        free(saved);
+        return -1;
+    }
+    memset(snapshot_id, 0xff, interned * sizeof(StringId));
+    for (int i = 0; i < model->history_size; i++) {
+        keep_string(snapshot_id, history_at(model, i));
+    }
+    for (int b = 0; b < model->bucket_count; b++) {
+        for (NGramContext *ctx = model->buckets[b]; ctx; ctx = ctx->next) {
+            for (int j = 0; j < ctx->length; j++) {
+                keep_string(snapshot_id, ctx->context[j]);
             }
-            
-            if (match) {
-                total += model->ngrams[j].count;
+            for (int i = 0; i < ctx->successor_count; i++) {
+                keep_string(snapshot_id, ctx->successors[i].command);
             }
         }
-        
-        // Calculate probability with add-k smoothing
-        if (total > 0) {
-            model->ngrams[i].probability = 
-                (model->ngrams[i].count + SMOOTHING_FACTOR) / 
-                (total + SMOOTHING_FACTOR * model->size);
+    }
+    for (int i = 0; i < command_db_size; i++) {
+        keep_string(snapshot_id, command_db[i].command);
+        for (int j = 0; j < command_db[i].arg_count; j++) {
+            keep_string(snapshot_id, command_db[i].args[j]);
+        }
+        for (int j = 0; j < command_db[i].context_count; j++) {
+            keep_string(snapshot_id, command_db[i].contexts[j]);
         }
     }
+    uint32_t saved_count = 0;
+    for (StringId id = 0; id < interned; id++) {
+        if (snapshot_id[id] == NO_STRING) continue;
+        snapshot_id[id] = saved_count;
+        saved[saved_count++] = id;
+    }
+    
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.order = model->order;
+    hdr.history_capacity = model->history_capacity;
+    hdr.string_count = saved_count;
+    hdr.history_count = model->history_size;
+    hdr.ngram_count = model->size;
+    hdr.command_count = command_db_size;
+    
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        hdr.string_data_size += strlen(interned_string(saved[i])) + 1;
+    }
+    hdr.string_offsets = align8(sizeof(hdr));
+    hdr.string_hashes = align8(hdr.string_offsets + hdr.string_count * sizeof(uint32_t));
+    hdr.string_data = align8(hdr.string_hashes + hdr.string_count * sizeof(uint32_t));
+    hdr.history = align8(hdr.string_data + hdr.string_data_size);
+    hdr.ngrams = align8(hdr.history + hdr.history_count * sizeof(StringId));
+    hdr.commands = align8(hdr.ngrams + hdr.ngram_count * sizeof(SnapshotNGram));
+    hdr.file_size = hdr.commands + hdr.command_count * sizeof(SnapshotCommand);
+    
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(snapshot_id);
+        free(saved);
+        return -1;
+    }
+    
+    uint64_t offset = 0;
+    int err = write_all(f, &hdr, sizeof(hdr), &offset);
+    
+    err |= pad_to(f, hdr.string_offsets, &offset);
+    uint32_t string_offset = 0;
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        err |= write_all(f, &string_offset, sizeof(string_offset), &offset);
+        string_offset += strlen(interned_string(saved[i])) + 1;
+    }
+    
+    err |= pad_to(f, hdr.string_hashes, &offset);
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        uint32_t hash = interned_hash(saved[i]);
+        err |= write_all(f, &hash, sizeof(hash), &offset);
+    }
+    
+    err |= pad_to(f, hdr.string_data, &offset);
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        const char *str = interned_string(saved[i]);
+        err |= write_all(f, str, strlen(str) + 1, &offset);
+    }
+    
+    err |= pad_to(f, hdr.history, &offset);
+    for (int i = 0; i < model->history_size; i++) {
+        StringId id = snapshot_string(snapshot_id, history_at(model, i));
+        err |= write_all(f, &id, sizeof(id), &offset);
+    }
+    
+    err |= pad_to(f, hdr.ngrams, &offset);
+    for (int b = 0; b < model->bucket_count; b++) {
+        for (NGramContext *ctx = model->buckets[b]; ctx; ctx = ctx->next) {
+            for (int i = 0; i < ctx->successor_count; i++) {
+                SnapshotNGram rec;
+                memset(&rec, 0, sizeof(rec));
+                rec.length = ctx->length;
+                for (int j = 0; j < ctx->length; j++) {
+                    rec.context[j] = snapshot_string(snapshot_id, ctx->context[j]);
+                }
+                rec.next_command = snapshot_string(snapshot_id, ctx->successors[i].command);
+                rec.count = ctx->successors[i].count;
+                err |= write_all(f, &rec, sizeof(rec), &offset);
+            }
+        }
+    }
+    
+    err |= pad_to(f, hdr.commands, &offset);
+    for (int i = 0; i < command_db_size; i++) {
+        SnapshotCommand rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.command = snapshot_string(snapshot_id, command_db[i].command);
+        rec.total_uses = command_db[i].total_uses;
+        rec.last_used = command_db[i].last_used;
+        rec.arg_count = command_db[i].arg_count;
+        for (int j = 0; j < rec.arg_count; j++) {
+            rec.args[j] = snapshot_string(snapshot_id, command_db[i].args[j]);
+        }
+        rec.context_count = command_db[i].context_count;
+        for (int j = 0; j < rec.context_count; j++) {
+            rec.contexts[j] = snapshot_string(snapshot_id, command_db[i].contexts[j]);
+        }
+        err |= write_all(f, &rec, sizeof(rec), &offset);
+    }
+    free(snapshot_id);
+    free(saved);
+    
+    if (fclose(f) != 0) err = -1;
+    if (err || offset != hdr.file_size || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    snapshot_history_inode = hdr.history_inode;
+    snapshot_history_offset = hdr.history_offset;
+    return 0;
+}
+
+// Save the trained model so the next startup can skip retraining. Without
+// 'force' this only writes once enough new commands have been learned;
+// with it, also when the history file was compacted since the last save,
+// which would otherwise make the snapshot unusable.
+void checkpoint_ai_suggest(int force) {
+    pthread_mutex_lock(&ai_lock);
+    uint64_t inode, offset;
+    int moved = get_history_position(&inode, &offset) == 0 && inode != snapshot_history_inode;
+    if (ngram_model.command_history &&
+        ((unsaved_commands > 0 && (force || unsaved_commands >= AI_CHECKPOINT_INTERVAL)) ||
+         (force && moved))) {
+        if (save_snapshot(&ngram_model) == 0) {
+            unsaved_commands = 0;
+        } else {
+            fprintf(stderr, "Warning: Could not save suggestion model\n");
+        }
+    }
+    pthread_mutex_unlock(&ai_lock);
 }
 
-// Analyze command history to learn patterns
-void analyze_command_history() {
-    // Get the current history state
-    HISTORY_STATE *hs = history_get_history_state();
-    if (!hs || hs->length < 2) {
-        free(hs);
-        return; // Need at least 2 commands to find patterns
+// Call 'visit' for each directory a command was recorded in; directories
+// shared by several commands are visited once per command. Never waits for
+// the model: returns -1 if it is busy or not built yet.
+int for_each_command_context(void (*visit)(const char *dir)) {
+    if (pthread_mutex_trylock(&ai_lock) != 0) return -1;
+    if (!model_ready) {
+        pthread_mutex_unlock(&ai_lock);
+        return -1;
     }
+    for (int i = 0; i < command_db_size; i++) {
+        for (int j = 0; j < command_db[i].context_count; j++) {
+            visit(interned_string(command_db[i].contexts[j]));
+        }
+    }
+    pthread_mutex_unlock(&ai_lock);
+    return 0;
+}
+
+// Learn from the history file's lines
+static void train_from_history(HistoryLines *history) {
+    if (!history || history->count == 0) return;
+    char **lines = history->lines;
+    int count = history->count;
     
     // Limit the number of history entries to analyze
-    int start = (hs->length > MAX_HISTORY_ANALYSIS) ? 
-                (hs->length - MAX_HISTORY_ANALYSIS) : 0;
+    int start = (count > MAX_HISTORY_ANALYSIS) ? 
+                (count - MAX_HISTORY_ANALYSIS) : 0;
     
-    // Add sequences from history
-    for (int i = start + 1; i < hs->length; i++) {
-        HIST_ENTRY *prev_he = history_get(i-1);
-        HIST_ENTRY *curr_he = history_get(i);
-        
-        if (prev_he && curr_he && prev_he->line && curr_he->line) {
-            add_command_sequence(prev_he->line, curr_he->line);
+    // Skip what the snapshot already learned: the lines before the offset
+    // it recorded in this same file
+    if (snapshot_history_inode != 0 && snapshot_history_inode == history->inode) {
+        while (start < count && (uint64_t)(lines[start] - history->data) < snapshot_history_offset) {
+            start++;
         }
     }
     
-    free(hs);
+    // Add sequences from history
+    for (int i = start; i < count; i++) {
+        learn_command(lines[i]);
+    }
 }
@@ -0,0 +1,82 @@
+#include "shell.h"
+
+#define ARENA_ALIGN 16
+
+// Blocks are chained newest first; data follows the header, starting on
+// an ARENA_ALIGN boundary like every offset into it
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+static ArenaBlock *new_block(size_t size) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (!block) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    ArenaBlock *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        // Oversized requests get a block of their own
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        block = new_block(block_size);
+        if (!block) return NULL;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+// Resize the block at 'ptr' (old_size bytes). The most recent allocation
+// grows in place when its block has room; anything else is copied.
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+    
+    ArenaBlock *block = arena->head;
+    size_t old_aligned = (old_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t new_aligned = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((char *)ptr + old_aligned == block->data + block->used &&
+        block->used - old_aligned + new_aligned <= block->size) {
+        block->used = block->used - old_aligned + new_aligned;
+        return ptr;
+    }
+    
+    void *copy = arena_alloc(arena, new_size);
+    if (!copy) return NULL;
+    memcpy(copy, ptr, old_size < new_size ? old_size : new_size);
+    return copy;
+}
@@ -0,0 +1,98 @@
+// Launch latency microbenchmark: fork+exec vs vfork+exec vs posix_spawn.
+//
+// The cost of fork() grows with the parent's mapped and touched memory, so
+// the benchmark first grows its own heap to resemble a long-running shell
+// (readline history, suggestion model, ...) and then times how long it takes
+// to start and reap /bin/true with each method.
+//
+// Usage: launch_bench [iterations] [heap MiB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_HEAP_MB 64
+
+extern char **environ;
+
+static char *const true_argv[] = { "true", NULL };
+static const char *true_path = "/bin/true";
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int launch_fork() {
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        execv(true_path, true_argv);
+        _exit(127);
+    }
+    return waitpid(pid, NULL, 0) == -1 ? -1 : 0;
+}
+
+static int launch_vfork() {
+    pid_t pid = vfork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        execv(true_path, true_argv);
+        _exit(127);
+    }
+    return waitpid(pid, NULL, 0) == -1 ? -1 : 0;
+}
+
+static int launch_spawn() {
+    pid_t pid;
+    // Same shape as the shell: file actions wire up stdin/stdout
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDOUT_FILENO);
+    int err = posix_spawn(&pid, true_path, &actions, NULL, true_argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) return -1;
+    return waitpid(pid, NULL, 0) == -1 ? -1 : 0;
+}
+
+static void run(const char *name, int (*launch)(), int iterations) {
+    // Warm up page cache and dynamic loader
+    for (int i = 0; i < 10; i++) launch();
+    
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        if (launch() == -1) {
+            perror(name);
+            return;
+        }
+    }
+    double elapsed = now_us() - start;
+    printf("%-8s %10.1f us/launch\n", name, elapsed / iterations);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    int heap_mb = argc > 2 ? atoi(argv[2]) : DEFAULT_HEAP_MB;
+    if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+    if (heap_mb < 0) heap_mb = 0;
+    
+    // Touch every page so they are really mapped
+    size_t heap_size = (size_t)heap_mb << 20;
+    char *heap = heap_size ? malloc(heap_size) : NULL;
+    if (heap) memset(heap, 1, heap_size);
+    
+    printf("%d launches of %s, %d MiB heap\n", iterations, true_path, heap_mb);
+    run("fork", launch_fork, iterations);
+    run("vfork", launch_vfork, iterations);
+    run("spawn", launch_spawn, iterations);
+    
+    free(heap);
+    return 0;
+}
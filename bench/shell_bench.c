@@ -0,0 +1,528 @@
+// End-to-end shell benchmark: drives myshell through a pseudo-terminal and
+// through script mode, and prints the results as JSON.
+//
+//   time_to_first_prompt_ms   fork of the shell until its prompt is drawn
+//   command_latency_ms        Enter until the next prompt, for builtins and
+//                             external commands; and per line of a script
+//   pipeline_mb_per_s         'cat FILE | cat | ...' with N cat stages
+//   suggestion_latency_ms     Enter until suggestions are shown, by the
+//                             number of lines in the history file
+//   directory_jump_ms         'z -l' with two words until the next prompt,
+//                             by the number of directories in the index
+//
+// Every run gets its own empty $HOME, so the user's history and model are
+// never read or written.
+//
+// Usage: shell_bench [shell] [runs] [pipeline MiB]
+
+#define _GNU_SOURCE  // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <time.h>
+#include <ftw.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SHELL "./myshell"
+#define DEFAULT_RUNS 20
+#define DEFAULT_PIPE_MB 64
+#define TIMEOUT_MS 5000
+#define SCRIPT_LINES 2000
+#define SESSION_BUFFER 65536
+
+// The prompt ends with the color reset before "$ "
+static const char prompt_marker[] = "\033[0m$ ";
+static const char suggestion_marker[] = "Suggestions:";
+
+static char shell[PATH_MAX];
+static char work_dir[] = "/tmp/shell_bench.XXXXXX";
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Statistics
+
+typedef struct {
+    double *samples;
+    int count;
+} Samples;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_stats(const Samples *s) {
+    if (s->count == 0) {
+        printf("null");
+        return;
+    }
+    qsort(s->samples, s->count, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (int i = 0; i < s->count; i++) sum += s->samples[i];
+    printf("{\"runs\": %d, \"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"max\": %.3f}",
+           s->count, s->samples[0], s->samples[s->count / 2], sum / s->count,
+           s->samples[s->count - 1]);
+}
+
+// Interactive sessions
+
+typedef struct {
+    pid_t pid;
+    int fd;
+    char buf[SESSION_BUFFER];
+    size_t len;
+} Session;
+
+static char *make_home(const char *name) {
+    char *home = malloc(strlen(work_dir) + strlen(name) + 2);
+    sprintf(home, "%s/%s", work_dir, name);
+    if (mkdir(home, 0700) == -1 && errno != EEXIST) {
+        perror(home);
+        exit(1);
+    }
+    return home;
+}
+
+static int start_session(Session *s, const char *home) {
+    struct winsize ws = { .ws_row = 50, .ws_col = 200 };
+    s->len = 0;
+    s->pid = forkpty(&s->fd, NULL, NULL, &ws);
+    if (s->pid == -1) {
+        perror("forkpty");
+        return -1;
+    }
+    if (s->pid == 0) {
+        if (chdir(home) == -1) _exit(127);
+        setenv("HOME", home, 1);
+        if (!getenv("TERM")) setenv("TERM", "xterm", 1);
+        execl(shell, shell, (char *)NULL);
+        _exit(127);
+    }
+    return 0;
+}
+
+// Read output until 'needle' shows up after offset 'from'. Returns 0, or -1
+// on timeout or EOF.
+static int wait_for(Session *s, const char *needle, size_t from) {
+    double deadline = now_ms() + TIMEOUT_MS;
+    size_t needle_len = strlen(needle);
+    for (;;) {
+        if (s->len > from && memmem(s->buf + from, s->len - from, needle, needle_len)) {
+            return 0;
+        }
+        double left = deadline - now_ms();
+        if (left <= 0) return -1;
+
+        // Keep the tail when the buffer fills up
+        if (s->len == sizeof(s->buf)) {
+            size_t keep = sizeof(s->buf) / 2;
+            memmove(s->buf, s->buf + s->len - keep, keep);
+            from = from > s->len - keep ? from - (s->len - keep) : 0;
+            s->len = keep;
+        }
+
+        struct pollfd pfd = { s->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)left + 1) <= 0) continue;
+        ssize_t n = read(s->fd, s->buf + s->len, sizeof(s->buf) - s->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        s->len += n;
+    }
+}
+
+static size_t send_line(Session *s, const char *line) {
+    size_t from = s->len;
+    char text[256];
+    int len = snprintf(text, sizeof(text), "%s\r", line);
+    if (write(s->fd, text, len) != len) perror("write");
+    return from;
+}
+
+// Time from Enter until 'marker' appears, in ms, or -1. Either way, returns
+// only once the next prompt is up.
+static double time_line(Session *s, const char *line, const char *marker) {
+    double start = now_ms();
+    size_t from = send_line(s, line);
+    double ms = wait_for(s, marker, from) == 0 ? now_ms() - start : -1;
+    if (marker != prompt_marker) wait_for(s, prompt_marker, from);
+    return ms;
+}
+
+static void end_session(Session *s) {
+    send_line(s, "exit");
+
+    // Drain until the shell closes the terminal, then reap it
+    double deadline = now_ms() + TIMEOUT_MS;
+    while (now_ms() < deadline) {
+        struct pollfd pfd = { s->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        char buf[4096];
+        if (read(s->fd, buf, sizeof(buf)) <= 0) break;
+    }
+    if (waitpid(s->pid, NULL, WNOHANG) == 0) {
+        kill(s->pid, SIGKILL);
+        waitpid(s->pid, NULL, 0);
+    }
+    close(s->fd);
+}
+
+// Script mode
+
+// Run the shell with 'args' and its output discarded; returns elapsed ms or -1
+static double time_shell(char *const args[]) {
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        setenv("HOME", work_dir, 1);
+        execv(shell, args);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return now_ms() - start;
+}
+
+static double time_script_string(const char *commands) {
+    char *args[] = { shell, "-c", (char *)commands, NULL };
+    return time_shell(args);
+}
+
+static char *write_script(const char *name, const char *line, int lines) {
+    char *path = malloc(strlen(work_dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", work_dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    for (int i = 0; i < lines; i++) fprintf(f, "%s\n", line);
+    fclose(f);
+    return path;
+}
+
+// Benchmarks
+
+static void bench_first_prompt(int runs) {
+    Samples s = { calloc(runs, sizeof(double)), 0 };
+    char *home = make_home("first_prompt");
+    for (int i = 0; i < runs; i++) {
+        Session session;
+        double start = now_ms();
+        if (start_session(&session, home) == -1) break;
+        if (wait_for(&session, prompt_marker, 0) == 0) {
+            s.samples[s.count++] = now_ms() - start;
+        }
+        end_session(&session);
+    }
+    printf("  \"time_to_first_prompt_ms\": ");
+    print_stats(&s);
+    printf(",\n");
+    free(s.samples);
+    free(home);
+}
+
+static const struct {
+    const char *name;
+    const char *line;
+} interactive_commands[] = {
+    { "builtin_pwd", "pwd" },
+    { "builtin_echo", "echo hello" },
+    { "builtin_cd", "cd ." },
+    { "external_true", "true" },
+    { "external_ls", "ls" },
+    { "pipeline_2", "true | true" },
+};
+#define INTERACTIVE_COMMANDS (int)(sizeof(interactive_commands) / sizeof(interactive_commands[0]))
+
+static void bench_commands(int runs) {
+    printf("  \"command_latency_ms\": {\n    \"interactive\": {\n");
+    char *home = make_home("commands");
+    Session session;
+    int ok = start_session(&session, home) == 0 && wait_for(&session, prompt_marker, 0) == 0;
+
+    // The first command pays for the deferred history and model loading
+    if (ok) time_line(&session, "true", prompt_marker);
+
+    for (int c = 0; c < INTERACTIVE_COMMANDS; c++) {
+        Samples s = { calloc(runs, sizeof(double)), 0 };
+        for (int i = 0; ok && i < runs; i++) {
+            double ms = time_line(&session, interactive_commands[c].line, prompt_marker);
+            if (ms >= 0) s.samples[s.count++] = ms;
+        }
+        printf("      \"%s\": ", interactive_commands[c].name);
+        print_stats(&s);
+        printf("%s\n", c + 1 < INTERACTIVE_COMMANDS ? "," : "");
+        free(s.samples);
+    }
+    if (session.pid > 0) end_session(&session);
+    free(home);
+
+    // Per line of a script: the whole run minus an empty script's, over
+    // the number of lines
+    static const struct {
+        const char *name;
+        const char *line;
+    } script_commands[] = {
+        { "builtin_cd", "cd ." },
+        { "external_true", "true" },
+    };
+    printf("    },\n    \"script_per_line\": {\n");
+    char *empty = write_script("empty.msh", "", 0);
+    for (int c = 0; c < 2; c++) {
+        char *path = write_script("lines.msh", script_commands[c].line, SCRIPT_LINES);
+        Samples s = { calloc(runs, sizeof(double)), 0 };
+        char *script_args[] = { shell, path, NULL };
+        char *empty_args[] = { shell, empty, NULL };
+        for (int i = 0; i < runs && i < 5; i++) {
+            double base = time_shell(empty_args);
+            double ms = time_shell(script_args);
+            if (base >= 0 && ms >= 0) s.samples[s.count++] = (ms - base) / SCRIPT_LINES;
+        }
+        printf("      \"%s\": ", script_commands[c].name);
+        print_stats(&s);
+        printf("%s\n", c + 1 < 2 ? "," : "");
+        free(s.samples);
+        free(path);
+    }
+    free(empty);
+
+    // Whole invocations: startup, one command, shutdown
+    Samples s = { calloc(runs, sizeof(double)), 0 };
+    for (int i = 0; i < runs; i++) {
+        double ms = time_script_string("true");
+        if (ms >= 0) s.samples[s.count++] = ms;
+    }
+    printf("    },\n    \"invocation_c_true\": ");
+    print_stats(&s);
+    printf("\n  },\n");
+    free(s.samples);
+}
+
+// Print the best of three runs of 'commands', which move pipe_mb MiB, in MB/s
+static void print_pipeline_rate(const char *commands, int pipe_mb) {
+    double best = -1;
+    for (int i = 0; i < 3; i++) {
+        double ms = time_script_string(commands);
+        if (ms > 0 && (best < 0 || ms < best)) best = ms;
+    }
+    if (best > 0) {
+        printf("%.1f", pipe_mb / (best / 1000.0));
+    } else {
+        printf("null");
+    }
+}
+
+static void bench_pipeline(int pipe_mb) {
+    // Input file of pipe_mb MiB
+    char *path = malloc(strlen(work_dir) + 16);
+    sprintf(path, "%s/pipe_input", work_dir);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char block[1 << 16];
+    memset(block, 'x', sizeof(block));
+    for (int i = 0; fd != -1 && i < pipe_mb * 16; i++) {
+        if (write(fd, block, sizeof(block)) != sizeof(block)) break;
+    }
+    if (fd != -1) close(fd);
+
+    printf("  \"pipeline_mb_per_s\": {\"input_mib\": %d", pipe_mb);
+    static const int stage_counts[] = { 1, 2, 4, 8 };
+    for (int k = 0; k < 4; k++) {
+        char commands[512];
+        int len = snprintf(commands, sizeof(commands), "cat %s", path);
+        for (int i = 1; i < stage_counts[k]; i++) {
+            len += snprintf(commands + len, sizeof(commands) - len, " | cat");
+        }
+        snprintf(commands + len, sizeof(commands) - len, " > /dev/null");
+        printf(", \"stages_%d\": ", stage_counts[k]);
+        print_pipeline_rate(commands, pipe_mb);
+    }
+
+    // A file fed into the first stage: by a cat process (/bin/cat bypasses
+    // the shell's splice path), spliced by the shell, and spliced into 1 MiB
+    // pipes
+    static const char *feeds[][2] = {
+        { "process", "/bin/cat %s | wc -c > /dev/null" },
+        { "splice", "cat %s | wc -c > /dev/null" },
+        { "splice_pipesize_1m", "shopt pipesize 1M; cat %s | wc -c > /dev/null" },
+    };
+    printf(", \"first_stage\": {");
+    for (int k = 0; k < 3; k++) {
+        char commands[512];
+        snprintf(commands, sizeof(commands), feeds[k][1], path);
+        printf("%s\"%s\": ", k > 0 ? ", " : "", feeds[k][0]);
+        print_pipeline_rate(commands, pipe_mb);
+    }
+    printf("}},\n");
+    unlink(path);
+    free(path);
+}
+
+// History file of 'lines' commands drawn from a fixed mix; it starts with
+// 'pwd' followed by another command so there is always something to suggest
+static void write_history(const char *home, int lines) {
+    static const char *commands[] = {
+        "ls", "ls -la", "pwd", "git status", "git diff", "make", "cd src",
+        "cd ..", "vim main.c", "echo done", "cat README.md", "true",
+    };
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.myshell_history", home);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "pwd\nls\n");
+    unsigned int seed = 12345;
+    for (int i = 2; i < lines; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(f, "%s\n", commands[(seed >> 16) % (sizeof(commands) / sizeof(commands[0]))]);
+    }
+    fclose(f);
+}
+
+static void bench_suggestions(int runs) {
+    static const int history_sizes[] = { 10, 100, 1000 };
+    printf("  \"suggestion_latency_ms\": {\n");
+    for (int h = 0; h < 3; h++) {
+        char name[64];
+        snprintf(name, sizeof(name), "history_%d", history_sizes[h]);
+        char *home = make_home(name);
+        write_history(home, history_sizes[h]);
+
+        // The first suggestion includes building the model from history;
+        // later ones only the lookup
+        Session session;
+        double first = -1;
+        Samples s = { calloc(runs, sizeof(double)), 0 };
+        if (start_session(&session, home) == 0 && wait_for(&session, prompt_marker, 0) == 0) {
+            first = time_line(&session, "pwd", suggestion_marker);
+            for (int i = 0; i < runs; i++) {
+                double ms = time_line(&session, "pwd", suggestion_marker);
+                if (ms >= 0) s.samples[s.count++] = ms;
+            }
+        }
+        if (session.pid > 0) end_session(&session);
+
+        printf("    \"%s\": {\"first\": ", name);
+        if (first >= 0) {
+            printf("%.3f", first);
+        } else {
+            printf("null");
+        }
+        printf(", \"warm\": ");
+        print_stats(&s);
+        printf("}%s\n", h + 1 < 3 ? "," : "");
+        free(s.samples);
+        free(home);
+    }
+    printf("  },\n");
+}
+
+// Frecency index of 'dirs' made-up directories, a few hundred per project
+static void write_directory_index(const char *home, int dirs) {
+    static const char *parts[] = { "src", "lib", "docs", "build", "test", "include" };
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.myshell_dirs", home);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    long now = time(NULL);
+    unsigned int seed = 12345;
+    for (int i = 0; i < dirs; i++) {
+        seed = seed * 1103515245 + 12345;
+        fprintf(f, "%u.5 %ld /home/user/work/project%d/%s/module%d\n", (seed >> 16) % 50,
+                now - (long)(seed % 2000000), i / 300,
+                parts[(seed >> 8) % (sizeof(parts) / sizeof(parts[0]))], i);
+    }
+    fclose(f);
+}
+
+static void bench_directory_jump(int runs) {
+    static const int index_sizes[] = { 1000, 10000, 50000 };
+    printf("  \"directory_jump_ms\": {\n");
+    for (int d = 0; d < 3; d++) {
+        char name[64];
+        snprintf(name, sizeof(name), "dirs_%d", index_sizes[d]);
+        char *home = make_home(name);
+        write_directory_index(home, index_sizes[d]);
+
+        // The first lookup includes reading the index
+        Session session;
+        double first = -1;
+        Samples s = { calloc(runs, sizeof(double)), 0 };
+        if (start_session(&session, home) == 0 && wait_for(&session, prompt_marker, 0) == 0) {
+            first = time_line(&session, "z -l project7 module2200", prompt_marker);
+            for (int i = 0; i < runs; i++) {
+                double ms = time_line(&session, "z -l project7 module2200", prompt_marker);
+                if (ms >= 0) s.samples[s.count++] = ms;
+            }
+        }
+        if (session.pid > 0) end_session(&session);
+
+        printf("    \"%s\": {\"first\": ", name);
+        if (first >= 0) {
+            printf("%.3f", first);
+        } else {
+            printf("null");
+        }
+        printf(", \"warm\": ");
+        print_stats(&s);
+        printf("}%s\n", d + 1 < 3 ? "," : "");
+        free(s.samples);
+        free(home);
+    }
+    printf("  }\n");
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // Absolute, since sessions run in their own $HOME
+    if (!realpath(argc > 1 ? argv[1] : DEFAULT_SHELL, shell)) {
+        perror(argc > 1 ? argv[1] : DEFAULT_SHELL);
+        return 1;
+    }
+    int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+    int pipe_mb = argc > 3 ? atoi(argv[3]) : DEFAULT_PIPE_MB;
+    if (runs <= 0) runs = DEFAULT_RUNS;
+    if (pipe_mb <= 0) pipe_mb = DEFAULT_PIPE_MB;
+
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *launch = getenv("MYSHELL_LAUNCH");
+    printf("{\n  \"shell\": \"%s\",\n  \"launch_mode\": \"%s\",\n  \"runs\": %d,\n",
+           shell, launch ? launch : "spawn", runs);
+    bench_first_prompt(runs);
+    bench_commands(runs);
+    bench_pipeline(pipe_mb);
+    bench_suggestions(runs);
+    bench_directory_jump(runs);
+    printf("}\n");
+
+    nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -12,13 +12,24 @@ typedef struct {
 
 // Command help information
 static const CommandHelp command_help[] = {
-    {"cd", "cd [directory]", "Change the current directory to 'directory'. If no directory is specified, changes to the home directory."},
+    {"cd", "cd [directory]", "Change the current directory to 'directory'. If no directory is specified, changes to the home directory. In an interactive shell, a plain name that is not a directory here goes where 'z name' would."},
     {"pwd", "pwd", "Print the current working directory."},
     {"echo", "echo [text...]", "Display a line of text."},
-    {"pinfo", "pinfo [pid]", "Display information about a process. If no PID is provided, shows information about the shell process."},
+    {"pinfo", "pinfo [-w interval] [pid]", "Display state, memory (RSS/PSS), threads, CPU time, I/O, open fds and current syscall of a process, the shell by default. -w samples it every 'interval' seconds until it exits or Ctrl+C."},
     {"setenv", "setenv VAR [value]", "Set an environment variable. If no value is provided, sets it to an empty string."},
     {"unsetenv", "unsetenv VAR", "Remove an environment variable."},
     {"help", "help [command]", "Display help information. If no command is specified, lists all available commands."},
+    {"hash", "hash [-r] [-t name...] [name...]", "Show the cached locations of commands used so far, look names up on $PATH, or forget the cache with -r."},
+    {"rehash", "rehash", "Rescan the $PATH directories for executables."},
+    {"exit", "exit [status]", "Exit the shell with 'status', or the status of the last command."},
+    {"jobs", "jobs", "List background and stopped jobs."},
+    {"fg", "fg [%job]", "Continue a job in the foreground."},
+    {"bg", "bg [%job]", "Continue a stopped job in the background."},
+    {"wait", "wait [%job|pid...]", "Wait for the given jobs, or for all background jobs, to finish."},
+    {"shopt", "shopt [option [value]]", "Show or set shell options. 'shopt launch fork|spawn' selects how external commands are started; 'shopt pipesize N[K|M]|default' sets the capacity of pipeline pipes."},
+    {"z", "z [-l] [word...]", "Go to the most frecent directory (visited often and recently) whose path contains the words in order, the last one in its final component. Characters of the words in order match when nothing contains them. -l lists the matches with their scores."},
+    {"j", "j [-l] [word...]", "Same as z."},
+    {"time", "time [pipeline]", "Run a pipeline and report real, user and sys time, max RSS and context switches for each stage."},
     
     // Common external commands
     {"ls", "ls [options] [file...]", "List directory contents."},
@@ -33,7 +44,7 @@ static const CommandHelp command_help[] = {
 };
 
 // Display help for all commands or a specific command
-void builtin_help(Command *cmd) {
+int builtin_help(Command *cmd) {
     if (cmd->arg_count > 1) {
         // Show help for a specific command
         const char *target_cmd = cmd->args[1];
@@ -58,6 +69,7 @@ void builtin_help(Command *cmd) {
             printf("Type 'help' to see a list of available commands.\n");
         }
         printf("\n");
+        return !found;
     } else {
         // Show help for all commands
         printf("\n\033[1;34m=== MiniShell - Available Commands ===\033[0m\n\n");
@@ -66,7 +78,7 @@ void builtin_help(Command *cmd) {
         // Print built-in commands
         printf("\033[1;32mBuilt-in Commands:\033[0m\n");
         for (int i = 0; command_help[i].name != NULL; i++) {
-            if (i == 7) {  // After built-in commands, print external commands
+            if (strcmp(command_help[i].name, "ls") == 0) {  // After built-in commands, print external commands
                 printf("\n\033[1;32mCommon External Commands:\033[0m\n");
             }
             printf("  \033[1;33m%-10s\033[0m - %s\n", 
@@ -79,9 +91,10 @@ void builtin_help(Command *cmd) {
         printf("  - 'show content of file.txt' instead of 'cat file.txt'\n");
         printf("  - 'go to folder' instead of 'cd folder'\n\n");
     }
+    return 0;
 }
 
-void builtin_cd(Command *cmd) {
+int builtin_cd(Command *cmd) {
     char *path = NULL;
     
     // Handle case where cmd or cmd->args is NULL
@@ -92,7 +105,7 @@ void builtin_cd(Command *cmd) {
         path = getenv("HOME");
         if (path == NULL) {
             fprintf(stderr, "cd: HOME not set\n");
-            return;
+            return 1;
         }
     } else {
         // Use the provided directory
@@ -102,94 +115,168 @@ void builtin_cd(Command *cmd) {
     // Check if path is still NULL (shouldn't happen, but better safe than sorry)
     if (path == NULL) {
         fprintf(stderr, "cd: No directory specified and HOME not set\n");
-        return;
+        return 1;
     }
     
-    // Attempt to change directory
-    if (chdir(path) != 0) {
+    if (change_directory(path) == 0) return 0;
+
+    // A bare name that isn't here may be a directory visited before
+    const char *target = NULL;
+    if (errno == ENOENT && frecency_active() && cmd && cmd->arg_count == 2 &&
+        path[0] != '.' && path[0] != '~' && !strchr(path, '/')) {
+        target = frecency_best(&cmd->args[1], 1);
+    }
+    if (!target) {
         perror("cd");
-    } else {
-        // Update PWD environment variable
-        char *cwd = getcwd(NULL, 0);
-        if (cwd != NULL) {
-            setenv("PWD", cwd, 1);
-            free(cwd);
-        }
+        return 1;
     }
+    printf("%s\n", target);
+    if (change_directory(target) != 0) {
+        perror("cd");
+        return 1;
+    }
+    return 0;
 }
 
-void builtin_pwd() {
+// Change the working directory and update PWD, the prompt and the
+// frecency index. Returns -1 with errno set on failure.
+int change_directory(const char *path) {
+    if (chdir(path) != 0) return -1;
+
     char *cwd = getcwd(NULL, 0);
     if (cwd != NULL) {
-        printf("%s\n", cwd);
-    } else {
+        setenv("PWD", cwd, 1);
+        frecency_visit(cwd, FRECENCY_CD_WEIGHT);
+        free(cwd);
+    }
+    prompt_invalidate(PROMPT_CWD);
+    return 0;
+}
+
+int builtin_pwd(Command *cmd) {
+    (void)cmd;
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
         perror("pwd");
+        return 1;
     }
+    printf("%s\n", cwd);
+    free(cwd);
+    return 0;
 }
 
-void builtin_echo(Command *cmd) {
+int builtin_echo(Command *cmd) {
     for (int i = 1; i < cmd->arg_count; i++) {
         printf("%s", cmd->args[i]);
         if (i < cmd->arg_count - 1) printf(" ");
     }
     printf("\n");
+    return 0;
 }
 
-void builtin_pinfo(Command *cmd) {
-    pid_t pid;
-    if (cmd->arg_count > 1) {
-        pid = atoi(cmd->args[1]);
-    } else {
-        pid = getpid();
-    }
-    
-    char proc_path[256];
-    char exe_path[256];
-    char status;
-    long vm_size;
-    
-    // Read process status
-    snprintf(proc_path, sizeof(proc_path), "/proc/%d/stat", pid);
-    FILE *stat_file = fopen(proc_path, "r");
-    if (stat_file) {
-        fscanf(stat_file, "%*d %*s %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %*u %*u %ld", &status, &vm_size);
-        fclose(stat_file);
-    }
-    
-    // Read executable path
-    snprintf(proc_path, sizeof(proc_path), "/proc/%d/exe", pid);
-    ssize_t len = readlink(proc_path, exe_path, sizeof(exe_path) - 1);
-    if (len != -1) {
-        exe_path[len] = '\0';
-    } else {
-        strcpy(exe_path, "Unknown");
-    }
-    
-    printf("pid -- %d\n", pid);
-    printf("Process Status -- %c\n", status);
-    printf("memory -- %ld\n", vm_size);
-    printf("Executable Path -- %s\n", exe_path);
-}
-
-void builtin_setenv(Command *cmd) {
+int builtin_setenv(Command *cmd) {
     if (cmd->arg_count < 2) {
         fprintf(stderr, "setenv: too few arguments\n");
-        return;
+        return 1;
     }
     
     char *value = cmd->arg_count > 2 ? cmd->args[2] : "";
     if (setenv(cmd->args[1], value, 1) != 0) {
         perror("setenv");
+        return 1;
     }
+    return 0;
 }
 
-void builtin_unsetenv(Command *cmd) {
+int builtin_unsetenv(Command *cmd) {
     if (cmd->arg_count < 2) {
         fprintf(stderr, "unsetenv: too few arguments\n");
-        return;
+        return 1;
     }
     
     if (unsetenv(cmd->args[1]) != 0) {
         perror("unsetenv");
+        return 1;
     }
-}
\ No newline at end of file
+    return 0;
+}
+
+int builtin_hash(Command *cmd) {
+    if (cmd->arg_count < 2) {
+        path_cache_print(NULL);
+        return 0;
+    }
+    
+    int status = 0;
+    int print_paths = 0;
+    for (int i = 1; i < cmd->arg_count; i++) {
+        if (strcmp(cmd->args[i], "-r") == 0) {
+            path_cache_rehash();
+        } else if (strcmp(cmd->args[i], "-t") == 0) {
+            print_paths = 1;
+        } else if (print_paths) {
+            if (path_cache_print(cmd->args[i]) != 0) {
+                fprintf(stderr, "hash: %s: not found\n", cmd->args[i]);
+                status = 1;
+            }
+        } else if (!path_cache_lookup(cmd->args[i])) {
+            fprintf(stderr, "hash: %s: not found\n", cmd->args[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int builtin_rehash(Command *cmd) {
+    (void)cmd;
+    path_cache_rehash();
+    path_cache_complete("", 0);  // Rebuild now rather than on next use
+    return 0;
+}
+
+// Show or change shell options
+static void print_pipe_size() {
+    if (shell_options.pipe_size) {
+        printf("pipesize\t%d\n", shell_options.pipe_size);
+    } else {
+        printf("pipesize\tdefault\n");
+    }
+}
+
+int builtin_shopt(Command *cmd) {
+    if (cmd->arg_count < 2) {
+        printf("launch\t%s\n", launch_mode_name(shell_options.launch_mode));
+        print_pipe_size();
+        return 0;
+    }
+    
+    const char *option = cmd->args[1];
+    if (strcmp(option, "launch") == 0) {
+        if (cmd->arg_count < 3) {
+            printf("launch\t%s\n", launch_mode_name(shell_options.launch_mode));
+        } else if (set_launch_mode(cmd->args[2]) == -1) {
+            fprintf(stderr, "shopt: launch: expected 'fork' or 'spawn'\n");
+            return 1;
+        }
+    } else if (strcmp(option, "pipesize") == 0) {
+        if (cmd->arg_count < 3) {
+            print_pipe_size();
+        } else if (set_pipe_size(cmd->args[2]) == -1) {
+            fprintf(stderr, "shopt: pipesize: %s: %s\n", cmd->args[2], strerror(errno));
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "shopt: %s: invalid option name\n", option);
+        return 1;
+    }
+    return 0;
+}
+
+// Leave the shell once the current command line is done
+int builtin_exit(Command *cmd) {
+    exit_requested = 1;
+    if (cmd->arg_count > 1) {
+        return atoi(cmd->args[1]) & 0xff;
+    }
+    return last_exit_status;
+}
@@ -0,0 +1,282 @@
+#include "shell.h"
+#include <dirent.h>
+#include <pwd.h>
+#include <limits.h>  // For PATH_MAX
+
+// Filename completion
+//
+// The word being completed is split at its last '/'. The directory part
+// may start with ~, ~user, $VAR or ${VAR}; it is expanded to find the
+// directory, but the completions keep it as it was typed. Listings are
+// cached per directory with their names sorted, so a prefix is found by
+// binary search; a cached listing is used as long as the directory's mtime
+// is unchanged, which costs one stat() per completion.
+
+#define COMPLETION_CACHE_SIZE 16
+#define LISTING_ARENA_BLOCK (64 * 1024)
+
+extern char **environ;
+
+enum { TYPE_UNKNOWN, TYPE_DIR, TYPE_OTHER };
+
+typedef struct {
+    const char *name;
+    unsigned char type;   // TYPE_*, resolved with stat() when needed
+} ListingEntry;
+
+typedef struct {
+    char *path;              // Absolute directory path, NULL for a free slot
+    struct timespec mtime;   // When it was read
+    Arena arena;             // Names
+    ListingEntry *entries;   // Sorted by name
+    int count;
+    unsigned long used;      // For least-recently-used eviction
+} DirListing;
+
+// The completion readline is asking for, one match per call
+typedef struct {
+    DirListing *listing;
+    char *typed_dir;    // Directory part as typed, with its trailing '/'
+    char *prefix;       // Name part
+    size_t prefix_len;
+    int next;           // Next entry to check
+    int show_hidden;    // The prefix starts with '.'
+} Query;
+
+static DirListing listings[COMPLETION_CACHE_SIZE];
+static unsigned long use_clock = 0;
+static Query query;
+
+static int compare_listing_entries(const void *a, const void *b) {
+    return strcmp(((const ListingEntry *)a)->name, ((const ListingEntry *)b)->name);
+}
+
+static void clear_listing(DirListing *listing) {
+    if (!listing->path) return;
+    free(listing->path);
+    free(listing->entries);
+    arena_free(&listing->arena);
+    memset(listing, 0, sizeof(*listing));
+}
+
+// Read a directory into 'listing'. Returns -1 if it can't be read.
+static int read_listing(DirListing *listing, const char *path, const struct stat *st) {
+    DIR *d = opendir(path);
+    if (!d) return -1;
+
+    clear_listing(listing);
+    listing->path = strdup(path);
+    listing->mtime = st->st_mtim;
+    arena_init(&listing->arena, LISTING_ARENA_BLOCK);
+
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' &&
+            (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (listing->count >= capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            ListingEntry *grown = realloc(listing->entries, capacity * sizeof(ListingEntry));
+            if (!grown) break;
+            listing->entries = grown;
+        }
+        ListingEntry *e = &listing->entries[listing->count];
+        e->name = arena_strndup(&listing->arena, entry->d_name, strlen(entry->d_name));
+        if (!e->name) break;
+        // Symlinks and unknown types are resolved only if they match
+        e->type = entry->d_type == DT_DIR ? TYPE_DIR :
+                  entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN ? TYPE_UNKNOWN :
+                  TYPE_OTHER;
+        listing->count++;
+    }
+    closedir(d);
+
+    qsort(listing->entries, listing->count, sizeof(ListingEntry), compare_listing_entries);
+    return 0;
+}
+
+// The listing of 'path' (absolute), read again if the directory changed
+static DirListing *get_listing(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) return NULL;
+
+    DirListing *slot = &listings[0];
+    for (int i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+        DirListing *listing = &listings[i];
+        if (listing->path && strcmp(listing->path, path) == 0) {
+            slot = listing;
+            break;
+        }
+        // Otherwise reuse a free slot or the least recently used one
+        if (slot->path && (!listing->path || listing->used < slot->used)) slot = listing;
+    }
+
+    if (!slot->path || strcmp(slot->path, path) != 0 ||
+        slot->mtime.tv_sec != st.st_mtim.tv_sec || slot->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        if (read_listing(slot, path, &st) == -1) return NULL;
+    }
+    slot->used = ++use_clock;
+    return slot;
+}
+
+// Expand a leading ~, ~user, $VAR or ${VAR} of a typed directory. Returns a
+// new string, or NULL if the user or variable doesn't exist.
+static char *expand_typed_dir(const char *typed) {
+    const char *value = NULL;
+    const char *rest = typed;
+
+    if (typed[0] == '~') {
+        size_t len = strcspn(typed + 1, "/");
+        if (len == 0) {
+            value = getenv("HOME");
+            if (!value) {
+                struct passwd *pw = getpwuid(getuid());
+                value = pw ? pw->pw_dir : NULL;
+            }
+        } else {
+            char *user = strndup(typed + 1, len);
+            struct passwd *pw = user ? getpwnam(user) : NULL;
+            value = pw ? pw->pw_dir : NULL;
+            free(user);
+        }
+        if (!value) return NULL;
+        rest = typed + 1 + len;
+    } else if (typed[0] == '$') {
+        int braced = typed[1] == '{';
+        const char *name = typed + 1 + braced;
+        size_t len = 0;
+        while (name[len] == '_' || isalnum((unsigned char)name[len])) len++;
+        if (len == 0 || (braced && name[len] != '}')) return NULL;
+
+        char *key = strndup(name, len);
+        value = key ? getenv(key) : NULL;
+        free(key);
+        if (!value) return NULL;
+        rest = name + len + braced;
+    }
+
+    size_t value_len = value ? strlen(value) : 0;
+    char *result = malloc(value_len + strlen(rest) + 1);
+    if (!result) return NULL;
+    if (value) memcpy(result, value, value_len);
+    strcpy(result + value_len, rest);
+    return result;
+}
+
+// Absolute form of a directory for the cache key
+static char *absolute_dir(const char *dir) {
+    if (dir[0] == '/') return strdup(dir);
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return NULL;
+    char *result = malloc(strlen(cwd) + strlen(dir) + 2);
+    if (!result) return NULL;
+    sprintf(result, "%s/%s", cwd, dir);
+    return result;
+}
+
+static void end_query() {
+    free(query.typed_dir);
+    free(query.prefix);
+    memset(&query, 0, sizeof(query));
+}
+
+static int start_query(const char *text) {
+    end_query();
+
+    const char *slash = strrchr(text, '/');
+    size_t dir_len = slash ? (size_t)(slash - text + 1) : 0;
+    query.typed_dir = strndup(text, dir_len);
+    query.prefix = strdup(text + dir_len);
+    if (!query.typed_dir || !query.prefix) return -1;
+    query.prefix_len = strlen(query.prefix);
+    query.show_hidden = query.prefix[0] == '.';
+
+    char *expanded = expand_typed_dir(dir_len ? query.typed_dir : ".");
+    char *path = expanded ? absolute_dir(expanded) : NULL;
+    free(expanded);
+    if (!path) return -1;
+    query.listing = get_listing(path);
+    free(path);
+    if (!query.listing) return -1;
+
+    // Binary search for the first name >= prefix
+    int lo = 0, hi = query.listing->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(query.listing->entries[mid].name, query.prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    query.next = lo;
+    return 0;
+}
+
+static int entry_is_dir(DirListing *listing, ListingEntry *entry) {
+    if (entry->type == TYPE_UNKNOWN) {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", listing->path, entry->name);
+        entry->type = stat(path, &st) == 0 && S_ISDIR(st.st_mode) ? TYPE_DIR : TYPE_OTHER;
+    }
+    return entry->type == TYPE_DIR;
+}
+
+// Environment variable names for a word like "$HO"
+static char *complete_variable(const char *text, int state) {
+    static int index;
+    if (!state) index = 0;
+
+    int braced = text[1] == '{';
+    const char *prefix = text + 1 + braced;
+    size_t len = strlen(prefix);
+    for (char *entry; (entry = environ[index]) != NULL; ) {
+        index++;
+        char *equals = strchr(entry, '=');
+        if (!equals || strncmp(entry, prefix, len) != 0 || (size_t)(equals - entry) < len) continue;
+
+        char *result = malloc(equals - entry + 4);
+        if (!result) return NULL;
+        sprintf(result, "%s%.*s%s", braced ? "${" : "$", (int)(equals - entry), entry,
+                braced ? "}" : "");
+        return result;
+    }
+    return NULL;
+}
+
+// Readline generator for file names: completion number 'state' of 'text',
+// directories with a trailing '/', or NULL when there are no more
+char *complete_filename(const char *text, int state) {
+    if (text[0] == '$' && !strchr(text, '/')) return complete_variable(text, state);
+    if (strcmp(text, "~") == 0) return state ? NULL : strdup("~/");
+
+    if (!state && start_query(text) == -1) {
+        end_query();
+        return NULL;
+    }
+    if (!query.listing) return NULL;
+
+    DirListing *listing = query.listing;
+    while (query.next < listing->count) {
+        ListingEntry *entry = &listing->entries[query.next++];
+        if (strncmp(entry->name, query.prefix, query.prefix_len) != 0) break;
+        if (entry->name[0] == '.' && !query.show_hidden) continue;
+
+        int is_dir = entry_is_dir(listing, entry);
+        size_t dir_len = strlen(query.typed_dir);
+        char *result = malloc(dir_len + strlen(entry->name) + 2);
+        if (!result) break;
+        sprintf(result, "%s%s%s", query.typed_dir, entry->name, is_dir ? "/" : "");
+        return result;
+    }
+    end_query();
+    return NULL;
+}
+
+void free_completion_cache() {
+    end_query();
+    for (int i = 0; i < COMPLETION_CACHE_SIZE; i++) {
+        clear_listing(&listings[i]);
+    }
+}
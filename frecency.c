@@ -0,0 +1,549 @@
+#include "shell.h"
+#include <math.h>
+#include <time.h>
+#include <limits.h>  // For PATH_MAX
+
+// Frecency index of visited directories, for z/j and completion
+//
+// Every visit adds a weight to the directory's score, and scores halve
+// every FRECENCY_HALF_LIFE seconds. Rather than decaying every entry, each
+// keeps rank = log2(score) + t / half-life, t being the time of its last
+// visit; the score now is 2^(rank - now / half-life). Ranks of entries
+// visited at different times compare like their current scores, so a query
+// only matches strings and compares doubles.
+//
+// The index is read from ~/.myshell_dirs on first use. A new one is seeded
+// from the directories the suggestion model recorded commands in, once the
+// model is built. Writes merge with what other shells saved meanwhile.
+
+#define FRECENCY_FILE ".myshell_dirs"
+#define FRECENCY_HALF_LIFE (7 * 24 * 3600.0)   // One week
+#define FRECENCY_MIN_SCORE 0.01                // Forgotten below this
+#define FRECENCY_MAX_DIRS 50000
+#define FRECENCY_SAVE_EVERY 16.0               // Weight of visits between saves
+#define FRECENCY_ARENA_BLOCK (64 * 1024)
+#define FRECENCY_LIST_MAX 20                   // Completions offered
+#define FRECENCY_MAX_WORDS 16
+#define FRECENCY_PICKS 4                       // Best matches found without sorting
+
+typedef struct {
+    const char *path;
+    const char *lower;  // Lowercased, for matching
+    size_t base;        // Offset of the last component
+    double rank;
+    unsigned int hash;  // Of the path
+    int gone;           // No longer a directory; dropped on save
+} DirEntry;
+
+// Characters a path and its last component contain, one bit per class; a
+// query can't match unless they include all of its own. Kept apart from
+// the entries so a lookup scans a small dense array.
+typedef struct {
+    uint64_t path;
+    uint64_t base;
+} CharMask;
+
+static Arena dir_arena;            // Paths
+static DirEntry *entries = NULL;
+static CharMask *masks = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+static int *slots = NULL;          // Open addressing, entry index + 1
+static int slot_count = 0;
+static int loaded = 0;
+static int recording = 0;          // Interactive shells record visits
+static int seeding = 0;            // No index file yet; seed from the model
+static double unsaved = 0;         // Weight of the visits since the last save
+
+static double rank_now(double score, time_t when) {
+    return log2(score) + when / FRECENCY_HALF_LIFE;
+}
+
+static double score_now(double rank) {
+    return exp2(rank - time(NULL) / FRECENCY_HALF_LIFE);
+}
+
+// Bit of a lowercased character
+static uint64_t char_bit(unsigned char c) {
+    return (uint64_t)1 << (c >= 'a' && c <= 'z' ? c - 'a' :
+                           c >= '0' && c <= '9' ? 26 + c - '0' :
+                           36 + c % 28);
+}
+
+static uint64_t char_bits(const char *text) {
+    uint64_t bits = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        bits |= char_bit(tolower(*p));
+    }
+    return bits;
+}
+
+static unsigned int hash_path(const char *path) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h;
+}
+
+static int *find_slot(const char *path, unsigned int hash) {
+    unsigned int i = hash & (slot_count - 1);
+    while (slots[i] && (entries[slots[i] - 1].hash != hash ||
+                        strcmp(entries[slots[i] - 1].path, path) != 0)) {
+        i = (i + 1) & (slot_count - 1);
+    }
+    return &slots[i];
+}
+
+static void grow_slots() {
+    int new_count = slot_count ? slot_count * 2 : 1024;
+    free(slots);
+    slots = calloc(new_count, sizeof(int));
+    slot_count = slots ? new_count : 0;
+    for (int i = 0; slots && i < entry_count; i++) {
+        *find_slot(entries[i].path, entries[i].hash) = i + 1;
+    }
+}
+
+static DirEntry *find_entry(const char *path) {
+    if (!slot_count) return NULL;
+    int *slot = find_slot(path, hash_path(path));
+    return *slot ? &entries[*slot - 1] : NULL;
+}
+
+static DirEntry *add_entry(const char *path, double rank) {
+    if ((entry_count + 1) * 2 > slot_count) {
+        grow_slots();
+        if (!slot_count) return NULL;
+    }
+    unsigned int hash = hash_path(path);
+    int *slot = find_slot(path, hash);
+    if (*slot) return &entries[*slot - 1];
+
+    if (entry_count >= entry_capacity) {
+        int capacity = entry_capacity ? entry_capacity * 2 : 1024;
+        DirEntry *grown = realloc(entries, capacity * sizeof(DirEntry));
+        if (!grown) return NULL;
+        entries = grown;
+        CharMask *grown_masks = realloc(masks, capacity * sizeof(CharMask));
+        if (!grown_masks) return NULL;
+        masks = grown_masks;
+        entry_capacity = capacity;
+    }
+
+    size_t length = strlen(path);
+    char *copy = arena_strndup(&dir_arena, path, length);
+    char *lower = arena_strndup(&dir_arena, path, length);
+    if (!copy || !lower) return NULL;
+
+    // Lowercase and collect the masks in one pass; the big index is read
+    // at startup
+    CharMask mask = { 0, 0 };
+    size_t base = 0;
+    for (size_t i = 0; i < length; i++) {
+        lower[i] = tolower((unsigned char)lower[i]);
+        uint64_t bit = char_bit(lower[i]);
+        mask.path |= bit;
+        mask.base |= bit;
+        if (lower[i] == '/' && i + 1 < length) {
+            base = i + 1;
+            mask.base = 0;
+        }
+    }
+    if (base == 0) mask.base = mask.path;
+
+    entries[entry_count] = (DirEntry){ copy, lower, base, rank, hash, 0 };
+    masks[entry_count] = mask;
+    DirEntry *entry = &entries[entry_count];
+    *slot = ++entry_count;
+    return entry;
+}
+
+static char *get_frecency_path() {
+    static char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    if (!home) return NULL;
+    snprintf(path, sizeof(path), "%s/%s", home, FRECENCY_FILE);
+    return path;
+}
+
+// A plain decimal as written by save_frecency_index; strtod() would be a
+// good part of the load time
+static const char *parse_score(const char *p, double *score) {
+    long digits = 0;
+    long divisor = 1;
+    int fraction = 0;
+    for (; isdigit((unsigned char)*p) || (*p == '.' && !fraction); p++) {
+        if (*p == '.') {
+            fraction = 1;
+        } else if (digits < 100000000000000L) {  // Digits beyond are dropped
+            digits = digits * 10 + (*p - '0');
+            if (fraction) divisor *= 10;
+        }
+    }
+    *score = (double)digits / divisor;
+    return p;
+}
+
+// Read "score time path" lines, calling 'add' for each
+static int read_index_file(void (*add)(const char *path, double rank)) {
+    const char *file_path = get_frecency_path();
+    FILE *file = file_path ? fopen(file_path, "r") : NULL;
+    if (!file) return -1;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &size, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+        double score;
+        char *end = (char *)parse_score(line, &score);
+        long when = strtol(end, &end, 10);
+        if (score > 0 && *end == ' ' && end[1] == '/') add(end + 1, rank_now(score, when));
+    }
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+static void load_entry(const char *path, double rank) {
+    add_entry(path, rank);
+}
+
+static void seed_entry(const char *path) {
+    if (path[0] == '/' && add_entry(path, rank_now(1, time(NULL)))) unsaved += 1;
+}
+
+// A new index is seeded once the suggestion worker has built the model;
+// building it here would put that back in front of the first command
+static void ensure_loaded() {
+    if (!loaded) {
+        loaded = 1;
+        arena_init(&dir_arena, FRECENCY_ARENA_BLOCK);
+        seeding = read_index_file(load_entry) == -1 && recording;
+    }
+    if (seeding && for_each_command_context(seed_entry) == 0) seeding = 0;
+}
+
+void init_frecency(int interactive) {
+    recording = interactive;
+}
+
+// Whether visits are recorded, which is when cd may fall back on the index
+int frecency_active() {
+    return recording;
+}
+
+// Count a visit to 'dir' (the working directory if NULL) with 'weight'
+void frecency_visit(const char *dir, double weight) {
+    if (!recording) return;
+    char cwd[PATH_MAX];
+    if (!dir) {
+        if (!getcwd(cwd, sizeof(cwd))) return;
+        dir = cwd;
+    }
+    if (dir[0] != '/' || strchr(dir, '\n')) return;
+    ensure_loaded();
+
+    time_t now = time(NULL);
+    DirEntry *entry = find_entry(dir);
+    if (entry && !entry->gone) {
+        // The score decayed to now, plus the weight
+        entry->rank = rank_now(score_now(entry->rank) + weight, now);
+    } else if (entry) {
+        entry->rank = rank_now(weight, now);
+        entry->gone = 0;
+    } else {
+        add_entry(dir, rank_now(weight, now));
+    }
+    unsaved += weight;
+}
+
+// Matching
+
+typedef struct {
+    char *tokens[FRECENCY_MAX_WORDS];  // Lowercased
+    size_t lengths[FRECENCY_MAX_WORDS];
+    int count;
+    CharMask mask;                     // Needed of a matching entry
+} DirQuery;
+
+static void start_dir_query(DirQuery *query, char *const *words, int count) {
+    query->count = 0;
+    query->mask = (CharMask){ 0, 0 };
+    for (int i = 0; i < count && query->count < FRECENCY_MAX_WORDS; i++) {
+        if (!*words[i]) continue;
+        char *token = strdup(words[i]);
+        if (!token) break;
+        for (char *p = token; *p; p++) *p = tolower((unsigned char)*p);
+        query->lengths[query->count] = strlen(token);
+        query->tokens[query->count++] = token;
+        query->mask.path |= char_bits(token);
+    }
+    if (query->count) query->mask.base = char_bits(query->tokens[query->count - 1]);
+}
+
+static void end_dir_query(DirQuery *query) {
+    for (int i = 0; i < query->count; i++) free(query->tokens[i]);
+    query->count = 0;
+}
+
+// strstr() for many short haystacks: strchr() skips to candidates without
+// strstr's per-call setup
+static const char *find_token(const char *haystack, const char *token, size_t length) {
+    for (const char *p = haystack; (p = strchr(p, token[0])) != NULL; p++) {
+        if (strncmp(p, token, length) == 0) return p;
+    }
+    return NULL;
+}
+
+// Where 'token' ends after 'from', or NULL. Fuzzy matching only needs the
+// token's characters in order.
+static const char *match_token(const char *from, const char *token, size_t length, int fuzzy) {
+    if (!fuzzy) {
+        const char *found = find_token(from, token, length);
+        return found ? found + length : NULL;
+    }
+    for (const char *t = token; *t && from; t++) {
+        from = strchr(from, *t);
+        if (from) from++;
+    }
+    return from;
+}
+
+// Each token occurs in order and the last one within the last component
+static int entry_matches(const DirEntry *entry, const DirQuery *query, int fuzzy) {
+    if (query->count == 0) return 1;
+
+    // The last component is short and rules out most entries
+    const char *base = entry->lower + entry->base;
+    int last = query->count - 1;
+    if (!match_token(base, query->tokens[last], query->lengths[last], fuzzy)) return 0;
+
+    const char *pos = entry->lower;
+    for (int i = 0; i < query->count && pos; i++) {
+        if (i == last && pos < base) pos = base;
+        pos = match_token(pos, query->tokens[i], query->lengths[i], fuzzy);
+    }
+    return pos != NULL;
+}
+
+static int compare_ranks(const void *a, const void *b) {
+    double ra = entries[*(const int *)a].rank, rb = entries[*(const int *)b].rank;
+    return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+// Indices of the matching entries, in index order; fuzzy matches only when
+// nothing matches exactly. Returns the count; *result must be freed.
+static int find_matches(const DirQuery *query, int **result) {
+    int *matches = malloc((entry_count ? entry_count : 1) * sizeof(int));
+    int count = 0;
+    for (int fuzzy = 0; matches && fuzzy < 2 && count == 0; fuzzy++) {
+        for (int i = 0; i < entry_count; i++) {
+            if ((masks[i].path & query->mask.path) != query->mask.path ||
+                (masks[i].base & query->mask.base) != query->mask.base) {
+                continue;
+            }
+            if (!entries[i].gone && entry_matches(&entries[i], query, fuzzy)) matches[count++] = i;
+        }
+    }
+    *result = matches;
+    return count;
+}
+
+static int is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// The best existing directory for the words other than the working
+// directory, or NULL. Directories that are gone are forgotten.
+const char *frecency_best(char *const *words, int count) {
+    ensure_loaded();
+    DirQuery query;
+    start_dir_query(&query, words, count);
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+
+    // The highest ranked match is nearly always the answer, so pick the
+    // first few without sorting them all
+    const char *best = NULL;
+    const char *here = NULL;
+    int *matches;
+    int match_count = find_matches(&query, &matches);
+    for (int i = 0; i < match_count && !best; i++) {
+        if (i == FRECENCY_PICKS) qsort(matches + i, match_count - i, sizeof(int), compare_ranks);
+        for (int j = i + 1; i < FRECENCY_PICKS && j < match_count; j++) {
+            if (entries[matches[j]].rank > entries[matches[i]].rank) {
+                int swap = matches[i];
+                matches[i] = matches[j];
+                matches[j] = swap;
+            }
+        }
+        DirEntry *entry = &entries[matches[i]];
+        if (!is_directory(entry->path)) {
+            entry->gone = 1;
+            unsaved += 1;
+        } else if (strcmp(entry->path, cwd) == 0) {
+            here = entry->path;
+        } else {
+            best = entry->path;
+        }
+    }
+    free(matches);
+    end_dir_query(&query);
+    return best ? best : here;
+}
+
+// Readline generator: directories for the word, best first
+char *frecency_completion(const char *text, int state) {
+    static int *matches = NULL;
+    static int match_count = 0;
+    static int next = 0;
+
+    if (!state) {
+        ensure_loaded();
+        free(matches);
+        DirQuery query;
+        char *words[1] = { (char *)text };
+        start_dir_query(&query, words, 1);
+        match_count = find_matches(&query, &matches);
+        if (matches) qsort(matches, match_count, sizeof(int), compare_ranks);
+        if (match_count > FRECENCY_LIST_MAX) match_count = FRECENCY_LIST_MAX;
+        end_dir_query(&query);
+        next = 0;
+    }
+    while (next < match_count) {
+        const char *path = entries[matches[next++]].path;
+        char *result = malloc(strlen(path) + 2);
+        if (result) sprintf(result, "%s%s", path, strcmp(path, "/") ? "/" : "");
+        return result;
+    }
+    free(matches);
+    matches = NULL;
+    match_count = 0;
+    return NULL;
+}
+
+// Saving
+
+static int compare_entries_by_rank(const void *a, const void *b) {
+    double ra = ((const DirEntry *)a)->rank, rb = ((const DirEntry *)b)->rank;
+    return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+// Entries another shell saved: keep the higher rank
+static void merge_entry(const char *path, double rank) {
+    DirEntry *entry = find_entry(path);
+    if (!entry) {
+        add_entry(path, rank);
+    } else if (!entry->gone && rank > entry->rank) {
+        entry->rank = rank;
+    }
+}
+
+// Write the index if it changed; 'force' writes even a few visits
+void save_frecency_index(int force) {
+    if (!loaded || !recording || unsaved == 0) return;
+    if (!force && unsaved < FRECENCY_SAVE_EVERY) return;
+    const char *path = get_frecency_path();
+    if (!path) return;
+
+    read_index_file(merge_entry);
+
+    // Best first; forgotten and removed entries are dropped
+    DirEntry *sorted = malloc((entry_count ? entry_count : 1) * sizeof(DirEntry));
+    if (!sorted) return;
+    int count = 0;
+    double min_rank = rank_now(FRECENCY_MIN_SCORE, time(NULL));
+    for (int i = 0; i < entry_count; i++) {
+        if (!entries[i].gone && entries[i].rank >= min_rank) sorted[count++] = entries[i];
+    }
+    qsort(sorted, count, sizeof(DirEntry), compare_entries_by_rank);
+    if (count > FRECENCY_MAX_DIRS) count = FRECENCY_MAX_DIRS;
+
+    char temp[PATH_MAX + 32];
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+    FILE *file = fopen(temp, "w");
+    if (!file) {
+        perror(temp);
+        free(sorted);
+        return;
+    }
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%.3f %ld %s\n", exp2(sorted[i].rank - now / FRECENCY_HALF_LIFE),
+                (long)now, sorted[i].path);
+    }
+    free(sorted);
+    if (fclose(file) != 0 || rename(temp, path) != 0) {
+        perror(path);
+        unlink(temp);
+        return;
+    }
+    unsaved = 0;
+}
+
+void free_frecency() {
+    if (!loaded) return;
+    arena_free(&dir_arena);
+    free(entries);
+    free(masks);
+    free(slots);
+    entries = NULL;
+    masks = NULL;
+    slots = NULL;
+    entry_count = entry_capacity = slot_count = 0;
+    loaded = seeding = 0;
+}
+
+// Builtin
+
+static void print_matches(char *const *words, int count) {
+    ensure_loaded();
+    DirQuery query;
+    start_dir_query(&query, words, count);
+    int *matches;
+    int match_count = find_matches(&query, &matches);
+    if (matches) qsort(matches, match_count, sizeof(int), compare_ranks);
+    for (int i = 0; i < match_count; i++) {
+        const DirEntry *entry = &entries[matches[i]];
+        printf("%10.2f  %s\n", score_now(entry->rank), entry->path);
+    }
+    free(matches);
+    end_dir_query(&query);
+}
+
+// z [-l] [word...]: go to the highest ranked directory matching the words,
+// or list the matches with -l. A directory that exists is entered as is.
+int builtin_z(Command *cmd) {
+    if (cmd->arg_count > 1 && strcmp(cmd->args[1], "-l") == 0) {
+        print_matches(cmd->args + 2, cmd->arg_count - 2);
+        return 0;
+    }
+    const char *target;
+    if (cmd->arg_count < 2) {
+        const char *home = getenv("HOME");
+        if (!home) {
+            fprintf(stderr, "%s: HOME not set\n", cmd->args[0]);
+            return 1;
+        }
+        target = home;
+    } else if (cmd->arg_count == 2 && is_directory(cmd->args[1])) {
+        target = cmd->args[1];
+    } else {
+        target = frecency_best(cmd->args + 1, cmd->arg_count - 1);
+    }
+    if (!target) {
+        fprintf(stderr, "%s: no directory matches", cmd->args[0]);
+        for (int i = 1; i < cmd->arg_count; i++) fprintf(stderr, " %s", cmd->args[i]);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    if (change_directory(target) != 0) {
+        perror(cmd->args[0]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "shell.h"
+#include <sys/mman.h>
+
+#define INTERN_ARENA_BLOCK (64 * 1024)
+
+// Every distinct string is stored once in the arena and identified by its
+// index in 'strings'. 'slots' is an open-addressing table of id + 1.
+static Arena intern_arena;
+static const char **strings = NULL;
+static uint32_t *hashes = NULL;
+static uint32_t string_count = 0;
+static uint32_t string_capacity = 0;
+static uint32_t *slots = NULL;
+static uint32_t slot_count = 0;
+
+// Strings adopted from a mapped snapshot point straight into the mapping
+static void *adopted_mapping = NULL;
+static size_t adopted_size = 0;
+
+// FNV-1a
+static uint32_t hash_string(const char *str, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Rehash into at least 'min_count' slots
+static void grow_slots(uint32_t min_count) {
+    uint32_t new_count = slot_count ? slot_count * 2 : 1024;
+    while (new_count < min_count) new_count *= 2;
+    uint32_t *new_slots = calloc(new_count, sizeof(uint32_t));
+    if (!new_slots) return;
+    
+    for (uint32_t id = 0; id < string_count; id++) {
+        uint32_t i = hashes[id] & (new_count - 1);
+        while (new_slots[i]) i = (i + 1) & (new_count - 1);
+        new_slots[i] = id + 1;
+    }
+    free(slots);
+    slots = new_slots;
+    slot_count = new_count;
+}
+
+// Returns the slot holding 'str', or the empty slot where it belongs
+static uint32_t *find_slot(const char *str, size_t len, uint32_t hash) {
+    uint32_t i = hash & (slot_count - 1);
+    while (slots[i]) {
+        uint32_t id = slots[i] - 1;
+        if (hashes[id] == hash && strncmp(strings[id], str, len) == 0 && strings[id][len] == '\0') {
+            break;
+        }
+        i = (i + 1) & (slot_count - 1);
+    }
+    return &slots[i];
+}
+
+StringId intern_lookup(const char *str) {
+    if (!str || string_count == 0) return NO_STRING;
+    size_t len = strlen(str);
+    uint32_t *slot = find_slot(str, len, hash_string(str, len));
+    return *slot ? *slot - 1 : NO_STRING;
+}
+
+StringId intern_string(const char *str) {
+    if (!str) return NO_STRING;
+    
+    // Keep the table at most half full
+    if ((string_count + 1) * 2 > slot_count) {
+        grow_slots((string_count + 1) * 2);
+        if (!slot_count) return NO_STRING;
+    }
+    
+    size_t len = strlen(str);
+    uint32_t hash = hash_string(str, len);
+    uint32_t *slot = find_slot(str, len, hash);
+    if (*slot) return *slot - 1;
+    
+    if (string_count >= string_capacity) {
+        string_capacity = string_capacity ? string_capacity * 2 : 1024;
+        strings = realloc(strings, string_capacity * sizeof(char *));
+        hashes = realloc(hashes, string_capacity * sizeof(uint32_t));
+    }
+    if (!intern_arena.block_size) {
+        arena_init(&intern_arena, INTERN_ARENA_BLOCK);
+    }
+    
+    StringId id = string_count++;
+    strings[id] = arena_strndup(&intern_arena, str, len);
+    hashes[id] = hash;
+    *slot = id + 1;
+    return id;
+}
+
+const char *interned_string(StringId id) {
+    return id < string_count ? strings[id] : NULL;
+}
+
+uint32_t interned_count() {
+    return string_count;
+}
+
+uint32_t interned_hash(StringId id) {
+    return id < string_count ? hashes[id] : 0;
+}
+
+// Seed an empty table with 'count' strings that live at data + offsets[id],
+// keeping their ids. The strings are not copied; 'mapping' stays mapped
+// until free_interned_strings().
+int intern_adopt(const char *data, const uint32_t *offsets, const uint32_t *string_hashes,
+                 uint32_t count, void *mapping, size_t mapping_size) {
+    if (string_count != 0 || adopted_mapping) return -1;
+    
+    string_capacity = 1024;
+    while (string_capacity < count) string_capacity *= 2;
+    strings = malloc(string_capacity * sizeof(char *));
+    hashes = malloc(string_capacity * sizeof(uint32_t));
+    if (!strings || !hashes) {
+        free(strings);
+        free(hashes);
+        strings = NULL;
+        hashes = NULL;
+        string_capacity = 0;
+        return -1;
+    }
+    
+    for (uint32_t id = 0; id < count; id++) {
+        strings[id] = data + offsets[id];
+        hashes[id] = string_hashes[id];
+    }
+    string_count = count;
+    
+    // Sized in one go: rehashing every string into a table that is too
+    // small would never find a free slot
+    grow_slots((string_count + 1) * 2);
+    if (!slot_count) {
+        free(strings);
+        free(hashes);
+        strings = NULL;
+        hashes = NULL;
+        string_count = string_capacity = 0;
+        return -1;
+    }
+    adopted_mapping = mapping;
+    adopted_size = mapping_size;
+    return 0;
+}
+
+void free_interned_strings() {
+    arena_free(&intern_arena);
+    free(strings);
+    free(hashes);
+    free(slots);
+    strings = NULL;
+    hashes = NULL;
+    slots = NULL;
+    string_count = string_capacity = slot_count = 0;
+    
+    if (adopted_mapping) {
+        munmap(adopted_mapping, adopted_size);
+        adopted_mapping = NULL;
+        adopted_size = 0;
+    }
+}
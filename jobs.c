@@ -0,0 +1,561 @@
+#include "shell.h"
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+// Job control
+//
+// Every pipeline that starts processes becomes a job. When the shell runs
+// on a terminal each job gets its own process group, and a foreground job
+// is handed the terminal with tcsetpgrp() until it exits or stops.
+//
+// SIGCHLD only writes a byte to a self-pipe; children are reaped from the
+// main thread by reap_jobs(), which the prompt loop and readline's event
+// hook call. Only pids that belong to a job are ever waited for, with
+// wait4() so each process's resource usage can be reported.
+
+typedef enum {
+    PROC_RUNNING,
+    PROC_STOPPED,
+    PROC_DONE
+} ProcState;
+
+typedef struct {
+    pid_t pid;
+    ProcState state;
+    int status;            // Exit status once done
+    struct timespec started;
+    StageUsage *report;    // Filled in when it exits, if set
+} JobProcess;
+
+struct Job {
+    int id;
+    pid_t pgid;
+    char *command;         // Text shown by 'jobs'
+    int foreground;
+    int notified;          // Current state has been reported
+    JobProcess *procs;
+    int proc_count;
+    int proc_capacity;
+    int has_tmodes;        // tmodes holds the modes it was stopped with
+    struct termios tmodes;
+};
+
+static Job **jobs = NULL;
+static int job_count = 0;
+static int job_capacity = 0;
+static Job *current_job = NULL;    // '+' in 'jobs', the default for fg/bg
+
+static int job_control = 0;
+static int shell_terminal = STDIN_FILENO;
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+static int sigchld_pipe[2] = {-1, -1};
+
+// Signals the interactive shell ignores and its children must not
+static const int job_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE };
+#define JOB_SIGNAL_COUNT ((int)(sizeof(job_signals) / sizeof(job_signals[0])))
+
+static void handle_sigchld(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    ssize_t ignored = write(sigchld_pipe[1], "", 1);  // Full pipe is fine
+    (void)ignored;
+    errno = saved_errno;
+}
+
+void init_job_control(int interactive) {
+    if (pipe(sigchld_pipe) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_sigchld;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGCHLD, &sa, NULL);
+    }
+
+    if (!interactive || !isatty(shell_terminal)) return;
+
+    // Wait until we are in the foreground
+    while (tcgetpgrp(shell_terminal) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Put the shell in its own process group and take the terminal
+    shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) == -1 && errno != EPERM) {
+        perror("setpgid");
+        return;
+    }
+    tcsetpgrp(shell_terminal, shell_pgid);
+    tcgetattr(shell_terminal, &shell_tmodes);
+    job_control = 1;
+}
+
+int job_control_enabled() {
+    return job_control;
+}
+
+// Process group a new process of 'job' should join: 0 for a new group led
+// by the process itself, or -1 when job control is off
+pid_t job_launch_pgid(Job *job) {
+    if (!job_control) return -1;
+    return job->pgid;
+}
+
+int job_takes_terminal(Job *job) {
+    return job_control && job->foreground && job->pgid == 0;
+}
+
+// Child side of a fork()ed job process: join the job's process group and
+// restore the signals the shell ignores or catches
+void job_child_setup(pid_t pgid, int foreground) {
+    if (pgid >= 0) {
+        setpgid(0, pgid);
+        if (foreground) tcsetpgrp(shell_terminal, pgid ? pgid : getpid());
+    }
+    for (int i = 0; i < JOB_SIGNAL_COUNT; i++) {
+        signal(job_signals[i], SIG_DFL);
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+// The same for posix_spawn()
+void job_spawn_attributes(posix_spawnattr_t *attr, pid_t pgid) {
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    sigset_t defaults, none;
+    sigemptyset(&defaults);
+    for (int i = 0; i < JOB_SIGNAL_COUNT; i++) {
+        sigaddset(&defaults, job_signals[i]);
+    }
+    sigemptyset(&none);
+    posix_spawnattr_setsigdefault(attr, &defaults);
+    posix_spawnattr_setsigmask(attr, &none);
+
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(attr, pgid);
+    }
+    posix_spawnattr_setflags(attr, flags);
+}
+
+int job_terminal_fd() {
+    return shell_terminal;
+}
+
+// The SIGCHLD self-pipe, for callers that wait on other fds too; -1 in
+// subshells
+int job_wakeup_fd() {
+    return sigchld_pipe[0];
+}
+
+// Job table
+
+static void remove_job(Job *job) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i] == job) {
+            memmove(&jobs[i], &jobs[i + 1], (job_count - i - 1) * sizeof(Job *));
+            job_count--;
+            break;
+        }
+    }
+    if (current_job == job) {
+        current_job = job_count > 0 ? jobs[job_count - 1] : NULL;
+    }
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+Job *job_create(const char *command, int foreground) {
+    Job *job = calloc(1, sizeof(Job));
+    if (!job) return NULL;
+    job->command = strdup(command);
+    job->foreground = foreground;
+
+    // Lowest free job number, keeping the table sorted by id
+    int id = 1;
+    int pos = 0;
+    while (pos < job_count && jobs[pos]->id == id) {
+        id++;
+        pos++;
+    }
+    job->id = id;
+
+    if (job_count >= job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 8;
+        jobs = realloc(jobs, job_capacity * sizeof(Job *));
+    }
+    memmove(&jobs[pos + 1], &jobs[pos], (job_count - pos) * sizeof(Job *));
+    jobs[pos] = job;
+    job_count++;
+    return job;
+}
+
+// Add a started process. 'report' receives its status and usage when it
+// exits; it must stay valid while the job runs in the foreground.
+void job_add_process(Job *job, pid_t pid, StageUsage *report) {
+    if (job->proc_count >= job->proc_capacity) {
+        job->proc_capacity = job->proc_capacity ? job->proc_capacity * 2 : 4;
+        job->procs = realloc(job->procs, job->proc_capacity * sizeof(JobProcess));
+    }
+    JobProcess *proc = &job->procs[job->proc_count++];
+    *proc = (JobProcess){ pid, PROC_RUNNING, 0, { 0, 0 }, report };
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+
+    if (job_control) {
+        // Also done by the child; whichever runs first wins the race
+        if (job->pgid == 0) job->pgid = pid;
+        setpgid(pid, job->pgid);
+    }
+}
+
+int job_process_count(Job *job) {
+    return job->proc_count;
+}
+
+void job_discard(Job *job) {
+    remove_job(job);
+}
+
+static int job_is_stopped(Job *job) {
+    for (int i = 0; i < job->proc_count; i++) {
+        if (job->procs[i].state == PROC_RUNNING) return 0;
+    }
+    for (int i = 0; i < job->proc_count; i++) {
+        if (job->procs[i].state == PROC_STOPPED) return 1;
+    }
+    return 0;
+}
+
+int job_stopped(Job *job) {
+    return job_is_stopped(job);
+}
+
+static int job_is_done(Job *job) {
+    for (int i = 0; i < job->proc_count; i++) {
+        if (job->procs[i].state != PROC_DONE) return 0;
+    }
+    return 1;
+}
+
+// Exit status of the job's last process
+static int job_status(Job *job) {
+    return job->proc_count ? job->procs[job->proc_count - 1].status : 0;
+}
+
+static void update_process(JobProcess *proc, int status, const struct rusage *usage) {
+    if (WIFSTOPPED(status)) {
+        proc->state = PROC_STOPPED;
+    } else if (WIFCONTINUED(status)) {
+        proc->state = PROC_RUNNING;
+    } else {
+        proc->state = PROC_DONE;
+        proc->status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+        if (proc->report) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            proc->report->status = proc->status;
+            proc->report->real_ms = (now.tv_sec - proc->started.tv_sec) * 1000.0 +
+                                    (now.tv_nsec - proc->started.tv_nsec) / 1000000.0;
+            proc->report->usage = *usage;
+        }
+    }
+}
+
+// Collect one state change of 'proc'. Returns 0 if nothing happened (only
+// possible with WNOHANG).
+static int wait_process(JobProcess *proc, int flags) {
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(proc->pid, &status, flags | WUNTRACED | WCONTINUED, &usage)) == -1 &&
+           errno == EINTR);
+    if (pid == 0) return 0;
+    if (pid == -1) {
+        // Already reaped elsewhere; treat as finished
+        proc->state = PROC_DONE;
+        return 1;
+    }
+    update_process(proc, status, &usage);
+    return 1;
+}
+
+// Block until every process of the job has exited or the job stopped.
+// Sleeping on the SIGCHLD pipe rather than on one pid reaps each process as
+// soon as it exits, so per-stage times are accurate.
+static void wait_job(Job *job) {
+    while (!job_is_done(job) && !job_is_stopped(job)) {
+        if (sigchld_pipe[0] != -1) {
+            struct pollfd pfd = { sigchld_pipe[0], POLLIN, 0 };
+            if (poll(&pfd, 1, -1) != -1 || errno == EINTR) {
+                reap_jobs();
+                continue;
+            }
+        }
+        for (int i = 0; i < job->proc_count; i++) {
+            if (job->procs[i].state == PROC_RUNNING) {
+                wait_process(&job->procs[i], 0);
+                break;
+            }
+        }
+    }
+}
+
+void reap_jobs() {
+    char buf[64];
+    while (sigchld_pipe[0] != -1 && read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+
+    for (int i = 0; i < job_count; i++) {
+        Job *job = jobs[i];
+        for (int j = 0; j < job->proc_count; j++) {
+            if (job->procs[j].state == PROC_DONE) continue;
+            if (wait_process(&job->procs[j], WNOHANG)) job->notified = 0;
+        }
+    }
+}
+
+static const char *job_state_name(Job *job) {
+    if (job_is_done(job)) return "Done";
+    if (job_is_stopped(job)) return "Stopped";
+    return "Running";
+}
+
+static void print_job(Job *job, FILE *out) {
+    char marker = job == current_job ? '+' : ' ';
+    const char *state = job_state_name(job);
+    if (job_is_done(job) && job_status(job) != 0) {
+        char exit_state[32];
+        snprintf(exit_state, sizeof(exit_state), "Exit %d", job_status(job));
+        fprintf(out, "[%d]%c  %-22s %s\n", job->id, marker, exit_state, job->command);
+    } else {
+        fprintf(out, "[%d]%c  %-22s %s%s\n", job->id, marker, state, job->command,
+                job_is_done(job) || job_is_stopped(job) ? "" : " &");
+    }
+}
+
+// Report background jobs that finished or stopped since the last prompt
+void notify_jobs() {
+    reap_jobs();
+    for (int i = 0; i < job_count; i++) {
+        Job *job = jobs[i];
+        if (job->notified || job->foreground) continue;
+        if (job_is_done(job)) {
+            print_job(job, stdout);
+            remove_job(job);
+            i--;
+        } else if (job_is_stopped(job)) {
+            print_job(job, stdout);
+            job->notified = 1;
+        } else {
+            job->notified = 1;
+        }
+    }
+    fflush(stdout);
+}
+
+// Run a job in the foreground until it exits or stops. 'cont' sends it
+// SIGCONT first. Returns its exit status, or 128+SIGTSTP if it stopped.
+int job_foreground(Job *job, int cont) {
+    job->foreground = 1;
+    if (job_control) {
+        tcsetpgrp(shell_terminal, job->pgid);
+        if (cont && job->has_tmodes) {
+            tcsetattr(shell_terminal, TCSADRAIN, &job->tmodes);
+        }
+    }
+    if (cont) {
+        for (int i = 0; i < job->proc_count; i++) {
+            if (job->procs[i].state == PROC_STOPPED) job->procs[i].state = PROC_RUNNING;
+        }
+        if (kill(job_control ? -job->pgid : job->procs[0].pid, SIGCONT) == -1) perror("kill");
+    }
+
+    wait_job(job);
+
+    if (job_control) {
+        // Take the terminal back, remembering the job's modes
+        tcsetpgrp(shell_terminal, shell_pgid);
+        job->has_tmodes = tcgetattr(shell_terminal, &job->tmodes) == 0;
+        tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+    }
+
+    if (job_is_stopped(job)) {
+        // The reports belong to the command that started the job
+        for (int i = 0; i < job->proc_count; i++) {
+            JobProcess *proc = &job->procs[i];
+            if (proc->report && proc->state != PROC_DONE) proc->report->status = 128 + SIGTSTP;
+            proc->report = NULL;
+        }
+        job->foreground = 0;
+        job->notified = 1;
+        current_job = job;
+        printf("\n");
+        print_job(job, stdout);
+        return 128 + SIGTSTP;
+    }
+
+    int status = job_status(job);
+    remove_job(job);
+    return status;
+}
+
+// Let a job run in the background; 'cont' restarts a stopped job
+void job_background(Job *job, int cont) {
+    job->foreground = 0;
+    current_job = job;
+    if (cont) {
+        for (int i = 0; i < job->proc_count; i++) {
+            if (job->procs[i].state == PROC_STOPPED) job->procs[i].state = PROC_RUNNING;
+        }
+        if (kill(job_control ? -job->pgid : job->procs[0].pid, SIGCONT) == -1) perror("kill");
+        job->notified = 1;
+        printf("[%d]%c %s &\n", job->id, '+', job->command);
+    } else if (job_control) {
+        printf("[%d] %d\n", job->id, job->procs[job->proc_count - 1].pid);
+    }
+    fflush(stdout);
+}
+
+// Forget all jobs: used by subshells, which don't own the parent's jobs
+void reset_jobs_in_subshell() {
+    while (job_count > 0) remove_job(jobs[0]);
+    job_control = 0;
+    if (sigchld_pipe[0] != -1) {
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        sigchld_pipe[0] = sigchld_pipe[1] = -1;
+    }
+    signal(SIGCHLD, SIG_DFL);
+}
+
+void free_jobs() {
+    // Stopped jobs would never be woken again
+    for (int i = 0; i < job_count; i++) {
+        if (job_is_stopped(jobs[i]) && job_control) {
+            kill(-jobs[i]->pgid, SIGHUP);
+            kill(-jobs[i]->pgid, SIGCONT);
+        }
+    }
+    while (job_count > 0) remove_job(jobs[0]);
+    free(jobs);
+    jobs = NULL;
+    job_capacity = 0;
+}
+
+// Job specs: %n, %+ / %% (current job), or a pid of one of the processes
+static Job *find_job(const char *spec, const char *builtin) {
+    Job *job = NULL;
+    if (!spec || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0) {
+        job = current_job;
+        if (!job) fprintf(stderr, "%s: no current job\n", builtin);
+        return job;
+    }
+
+    if (spec[0] == '%') {
+        int id = atoi(spec + 1);
+        for (int i = 0; i < job_count && !job; i++) {
+            if (jobs[i]->id == id) job = jobs[i];
+        }
+    } else {
+        pid_t pid = atoi(spec);
+        for (int i = 0; i < job_count && !job; i++) {
+            for (int j = 0; j < jobs[i]->proc_count; j++) {
+                if (jobs[i]->procs[j].pid == pid) job = jobs[i];
+            }
+        }
+    }
+    if (!job) fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+    return job;
+}
+
+int builtin_jobs(Command *cmd) {
+    (void)cmd;
+    reap_jobs();
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i]->foreground) continue;
+        print_job(jobs[i], stdout);
+        jobs[i]->notified = 1;
+    }
+
+    // Finished jobs have now been reported
+    for (int i = 0; i < job_count; i++) {
+        if (!jobs[i]->foreground && job_is_done(jobs[i])) remove_job(jobs[i--]);
+    }
+    return 0;
+}
+
+int builtin_fg(Command *cmd) {
+    if (!job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        return 1;
+    }
+    Job *job = find_job(cmd->arg_count > 1 ? cmd->args[1] : NULL, "fg");
+    if (!job) return 1;
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+    return job_foreground(job, 1);
+}
+
+int builtin_bg(Command *cmd) {
+    if (!job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        return 1;
+    }
+    Job *job = find_job(cmd->arg_count > 1 ? cmd->args[1] : NULL, "bg");
+    if (!job) return 1;
+
+    if (!job_is_stopped(job)) {
+        fprintf(stderr, "bg: job %d already in background\n", job->id);
+        return 0;
+    }
+    job_background(job, 1);
+    return 0;
+}
+
+// Wait for the given jobs, or for every background job
+int builtin_wait(Command *cmd) {
+    int status = 0;
+    if (cmd->arg_count < 2) {
+        while (job_count > 0) {
+            Job *job = NULL;
+            for (int i = 0; i < job_count && !job; i++) {
+                if (!jobs[i]->foreground && !job_is_stopped(jobs[i])) job = jobs[i];
+            }
+            if (!job) break;
+            wait_job(job);
+            if (job_is_done(job)) remove_job(job);
+            else job->notified = 0;
+        }
+        return 0;
+    }
+
+    for (int i = 1; i < cmd->arg_count; i++) {
+        Job *job = find_job(cmd->args[i], "wait");
+        if (!job) {
+            status = 127;
+            continue;
+        }
+        wait_job(job);
+        if (job_is_done(job)) {
+            status = job_status(job);
+            remove_job(job);
+        } else {
+            status = 128 + SIGTSTP;
+            job->notified = 0;
+        }
+    }
+    return status;
+}
@@ -4,7 +4,77 @@
 #include <dirent.h>
 #include <sys/stat.h>
 
-static int running = 1;
+#define DEFAULT_SUGGEST_BUDGET_MS 5
+
+
+// Suggestions were requested for the upcoming prompt and not shown yet
+static int suggestions_pending = 0;
+
+// When main started, for the time-to-first-prompt profile
+static double main_start;
+
+// Suggestions shown in front of the current prompt
+static char suggestion_line[512];
+
+static void format_suggestions(char **suggestions, int count) {
+    int length = snprintf(suggestion_line, sizeof(suggestion_line), "\033[90mSuggestions: ");
+    for (int i = 0; i < count; i++) {
+        if (i < 3 && length < (int)sizeof(suggestion_line)) {
+            length += snprintf(suggestion_line + length, sizeof(suggestion_line) - length,
+                               "%s%s", i > 0 ? ", " : "", suggestions[i]);
+        }
+        free(suggestions[i]);
+    }
+    free(suggestions);
+    // Reset color
+    if (length > (int)sizeof(suggestion_line) - 5) length = sizeof(suggestion_line) - 5;
+    strcpy(suggestion_line + length, "\033[0m");
+}
+
+// Draw the prompt line again in place: the suggestions on it, a freshly
+// built prompt and whatever has been typed
+static void redraw_prompt_line() {
+    printf("\r\033[K%s", suggestion_line);
+    fflush(stdout);
+    rl_set_prompt(get_prompt());
+    rl_on_new_line();
+    rl_redisplay();
+}
+
+// Readline idle hook: load history once the prompt is up, reap background
+// jobs as they finish, redraw the prompt when a slow segment is ready and
+// show suggestions that arrive after the prompt as long as nothing has been
+// typed yet
+static int shell_event_hook() {
+    load_command_history();
+    reap_jobs();
+    if (prompt_needs_redraw()) redraw_prompt_line();
+    if (!suggestions_pending) return 0;
+    
+    if (rl_end > 0) {
+        // Already typing: the suggestions are stale
+        cancel_command_suggestions();
+        suggestions_pending = 0;
+    } else {
+        char **suggestions;
+        int count;
+        if (!take_command_suggestions(0, &suggestions, &count)) return 0;
+        suggestions_pending = 0;
+        
+        if (count > 0) {
+            format_suggestions(suggestions, count);
+            redraw_prompt_line();
+        }
+    }
+    return 0;
+}
+
+// Runs once the first prompt has been drawn
+static int first_prompt_hook() {
+    profile_record("time to first prompt", main_start);
+    rl_pre_input_hook = NULL;
+    return 0;
+}
 
 void handle_sigint(int sig) {
     (void)sig;  // Suppress unused parameter warning
@@ -14,121 +84,166 @@ void handle_sigint(int sig) {
     rl_redisplay();
 }
 
-// Command generator function for tab completion
+// Command generator function for tab completion: builtins, then
+// executables on $PATH
 char *command_generator(const char *text, int state) {
-    static int list_index, len;
+    static int list_index, path_index, len;
     const char *name;
     static const char *commands[] = {
-        "cd", "pwd", "echo", "pinfo", "setenv", "unsetenv", "help",
-        "ls", "grep", "cat", "mkdir", "rm", "cp", "mv", NULL
+        "cd", "pwd", "echo", "pinfo", "setenv", "unsetenv", "help", "hash", "rehash",
+        "shopt", "exit", "jobs", "fg", "bg", "wait", "time", "z", "j", NULL
     };
 
     if (!state) {
         list_index = 0;
+        path_index = 0;
         len = strlen(text);
     }
 
-    // Check commands first
+    // Check built-in commands first
     while ((name = commands[list_index++])) {
         if (strncmp(name, text, len) == 0) {
             return strdup(name);
         }
     }
+    list_index--;  // Stay on the terminator for later calls
 
-    // Then check files in current directory
-    static DIR *dir = NULL;
-    static struct dirent *entry = NULL;
-    static char *dirname = NULL;
-    
-    if (!state) {
-        // Find the last space in the line
-        const char *last_space = strrchr(rl_line_buffer, ' ');
-        if (last_space) {
-            // If there's a space, we're completing a filename
-            if (dirname) free(dirname);
-            dirname = strndup(rl_line_buffer, last_space - rl_line_buffer + 1);
-            text = last_space + 1;
-            len = strlen(text);
-            
-            // Open the directory
-            if (dir) closedir(dir);
-            dir = opendir(".");
-            if (!dir) return NULL;
-        } else {
-            // No space, we're completing a command
-            return NULL;
-        }
+    if ((name = path_cache_complete(text, path_index++))) {
+        return strdup(name);
     }
+    return NULL;
+}
 
-    if (dir) {
-        while ((entry = readdir(dir)) != NULL) {
-            if (strncmp(entry->d_name, text, len) == 0) {
-                // If we have a directory, add a trailing slash
-                struct stat st;
-                if (stat(entry->d_name, &st) == 0 && S_ISDIR(st.st_mode)) {
-                    char *result = malloc(strlen(entry->d_name) + 2);
-                    sprintf(result, "%s/", entry->d_name);
-                    return result;
-                } else {
-                    return strdup(entry->d_name);
-                }
-            }
-        }
-        closedir(dir);
-        dir = NULL;
-    }
+// Whether the word starting at 'start' is in command position: first on the
+// line or after an operator
+static int is_command_word(int start) {
+    int i = start - 1;
+    while (i >= 0 && isspace((unsigned char)rl_line_buffer[i])) i--;
+    return i < 0 || strchr("|;&(", rl_line_buffer[i]);
+}
 
-    return NULL;
+// Whether the word starting at 'start' is an argument of command 'name'
+static int is_argument_of(int start, const char *name) {
+    int i = start;
+    while (i > 0 && !strchr("|;&(", rl_line_buffer[i - 1])) i--;
+    while (isspace((unsigned char)rl_line_buffer[i])) i++;
+    size_t len = strlen(name);
+    return i < start && strncmp(rl_line_buffer + i, name, len) == 0 &&
+           isspace((unsigned char)rl_line_buffer[i + len]);
+}
+
+// Frecency-ranked directories for the word. When there are several, the
+// word is kept as typed and they are listed best first.
+static char **directory_matches(const char *text) {
+    char **matches = rl_completion_matches(text, frecency_completion);
+    if (matches && matches[1]) {
+        free(matches[0]);
+        matches[0] = strdup(text);
+        rl_sort_completion_matches = 0;
+    }
+    return matches;
 }
 
 // Attempt to complete on the contents of TEXT
 char **command_completion(const char *text, int start, int end) {
-    (void)start;  // Unused parameter
     (void)end;    // Unused parameter
     rl_attempted_completion_over = 1;
-    return rl_completion_matches(text, command_generator);
+    rl_sort_completion_matches = 1;
+    if (is_command_word(start) && !strchr(text, '/') && text[0] != '~' && text[0] != '$') {
+        return rl_completion_matches(text, command_generator);
+    }
+    
+    char **matches = NULL;
+    if ((is_argument_of(start, "z") || is_argument_of(start, "j")) && text[0] != '-') {
+        matches = directory_matches(text);
+    } else {
+        matches = rl_completion_matches(text, complete_filename);
+        // cd to a name that isn't here falls back on the frecency index
+        if (!matches && is_argument_of(start, "cd") && *text && !strchr(text, '/') &&
+            text[0] != '.' && text[0] != '~' && text[0] != '$') {
+            matches = directory_matches(text);
+        }
+    }
+
+    // A unique directory is left open for the next Tab; a file gets a space
+    if (matches && !matches[1]) {
+        size_t len = strlen(matches[0]);
+        rl_completion_suppress_append = len > 0 && matches[0][len - 1] == '/';
+    }
+    return matches;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    main_start = profile_clock();
+    
+    // --startup-profile prints how long each startup phase took on exit
+    if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+        startup_profile = 1;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+    
+    // Scripts, -c and piped input skip everything interactive
+    if (argc > 1 || !isatty(STDIN_FILENO)) {
+        return run_script_mode(argc, argv);
+    }
+    
     // Initialize shell
-    init_shell();
+    init_shell(1);
     
     // Set up signal handling
     signal(SIGINT, handle_sigint);
     
     // Initialize readline
+    double start = profile_clock();
     using_history();
     
     // Set up tab completion
     rl_attempted_completion_function = command_completion;
-    rl_basic_word_break_characters = " \t\n\"\\'`@$><=;|&{(";
+    rl_basic_word_break_characters = " \t\n\"\\'`@><;|&(";
     rl_completion_append_character = '\0';
     rl_attempted_completion_over = 0;
     
+    // Suggestions are computed in the background; the prompt waits for them
+    // at most this long and the event hook shows late ones
+    const char *budget = getenv("MYSHELL_SUGGEST_BUDGET_MS");
+    int suggest_budget_ms = budget ? atoi(budget) : DEFAULT_SUGGEST_BUDGET_MS;
+    start_suggestion_worker();
+    rl_event_hook = shell_event_hook;
+    rl_set_keyboard_input_timeout(20000);
+    rl_pre_input_hook = first_prompt_hook;
+    profile_record("readline setup", start);
+    
     // Store the last command for suggestions
     char *last_command = NULL;
     
     // Main shell loop
-    while (running) {
-        // Show AI suggestions if we have command history
-        if (last_command) {
-            int suggestion_count = 0;
-            char **suggestions = get_command_suggestions(last_command, &suggestion_count);
-            
-            if (suggestion_count > 0) {
-                printf("\n\033[90mSuggestions: ");
-                for (int i = 0; i < suggestion_count && i < 3; i++) {
-                    printf("%s%s", i > 0 ? ", " : "", suggestions[i]);
-                    free(suggestions[i]);
+    while (!exit_requested) {
+        // Report background jobs that finished since the last prompt
+        notify_jobs();
+        
+        // Show AI suggestions if they are ready within the budget
+        if (suggestions_pending) {
+            char **suggestions;
+            int suggestion_count;
+            if (take_command_suggestions(suggest_budget_ms, &suggestions, &suggestion_count)) {
+                suggestions_pending = 0;
+                if (suggestion_count > 0) {
+                    format_suggestions(suggestions, suggestion_count);
+                    printf("\n%s", suggestion_line);
+                    fflush(stdout);
                 }
-                printf("\033[0m");  // Reset color
-                free(suggestions);
-                fflush(stdout);
             }
         }
         
         // Get input using readline
         char *input = readline(get_prompt());
+        suggestion_line[0] = '\0';
+        if (suggestions_pending) {
+            cancel_command_suggestions();
+            suggestions_pending = 0;
+        }
         if (!input) {
             printf("\n");
             break;  // Handle Ctrl+D
@@ -140,32 +255,40 @@ int main() {
             continue;
         }
         
-        // Add to history
+        // Add to history, after what the file already has
+        load_command_history();
         add_history(input);
-        save_command_history();
+        append_command_history(input);
         
         // Process natural language input
-        char *processed_line = natural_to_shell_command(input);
+        char *rewritten = natural_to_shell_command(input);
+        const char *processed_line = rewritten ? rewritten : input;
         if (strlen(processed_line) > 0) {
             // Parse and execute the command
-            Pipeline *pipeline = parse_line(processed_line);
-            if (pipeline) {
-                execute_pipeline(pipeline);
-                
-                // Update AI model with the new command sequence
-                if (last_command) {
-                    add_command_sequence(last_command, processed_line);
-                    free(last_command);
-                }
+            CommandLine *line;
+            if (parse_line(processed_line, &line) == 0 && line) {
+                // Update AI model with the new command sequence and start
+                // computing the next suggestions while the command runs
+                add_command_sequence(last_command, processed_line);
+                free(last_command);
                 last_command = strdup(processed_line);
+                request_command_suggestions(last_command);
+                suggestions_pending = 1;
+                
+                double started = profile_clock();
+                frecency_visit(NULL, FRECENCY_COMMAND_WEIGHT);
+                execute_line(line);
+                prompt_command_done(last_exit_status, profile_clock() - started);
+                checkpoint_ai_suggest(0);
+                save_frecency_index(0);
                 
-                free_pipeline(pipeline);
+                free_command_line(line);
             }
         }
         
         // Clean up
         free(input);
-        free(processed_line);
+        free(rewritten);
     }
     
     // Clean up
@@ -173,8 +296,8 @@ int main() {
         free(last_command);
     }
     
-    // Save command history before exiting
-    save_command_history();
+    // Save the trained model and command history before exiting
+    shutdown_shell();
     
-    return 0;
+    return last_exit_status;
 } 
\ No newline at end of file
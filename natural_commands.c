@@ -1,79 +1,336 @@
 #include "shell.h"
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>  // For PATH_MAX
 
-// Structure to map natural language patterns to commands
-typedef struct {
-    const char *pattern;
-    const char *command;
-} CommandMapping;
-
-// Common natural language patterns and their corresponding commands
-static const CommandMapping command_mappings[] = {
-    {"list files", "ls"},
-    {"show files", "ls"},
-    {"what's here", "ls"},
-    {"show me what's in this folder", "ls"},
-    
-    {"go to ", "cd "},  // Note the space after cd
-    {"change to ", "cd "},
-    {"navigate to ", "cd "},
-    
-    {"where am i", "pwd"},
-    {"current directory", "pwd"},
-    
-    {"show content of ", "cat "},
-    {"display ", "cat "},
-    {"open ", "cat "},
-    
-    {"search for ", "grep "},
-    {"find ", "grep "},
-    
-    {"count lines in ", "wc -l "},
-    {"word count of ", "wc -w "},
-    
-    {"make directory ", "mkdir "},
-    {"create folder ", "mkdir "},
-    
-    {"remove ", "rm "},
-    {"delete ", "rm "},
-    
-    {NULL, NULL}  // End of array marker
+// Natural-language rewriting
+//
+// Mappings such as "count lines in {file} = wc -l {file}" are read from
+// ~/.myshell_nl (the built-in table below if there is none) and compiled
+// into a trie over the lowercased patterns. A line is matched in one walk
+// from the root: a literal edge is taken if there is one, otherwise the
+// node's {slot} edge captures the next word, or the rest of the line when
+// nothing follows the slot. The longest complete pattern wins and whatever
+// follows it is appended to the command. Ordinary commands fall off the
+// trie within a character or two and are not copied at all.
+
+#define NL_FILE ".myshell_nl"
+#define NL_MAX_SLOTS 8
+#define NL_ARENA_BLOCK 4096
+
+// Built-in mappings, in the file's format
+static const char *default_mappings[] = {
+    "list files = ls",
+    "show files = ls",
+    "what's here = ls",
+    "show me what's in this folder = ls",
+
+    "go to {dir} = cd {dir}",
+    "change to {dir} = cd {dir}",
+    "navigate to {dir} = cd {dir}",
+
+    "where am i = pwd",
+    "current directory = pwd",
+
+    "show content of {file} = cat {file}",
+    "display {file} = cat {file}",
+    "open {file} = cat {file}",
+
+    "search for {pattern} = grep {pattern}",
+    "find {pattern} = grep {pattern}",
+
+    "count lines in {file} = wc -l {file}",
+    "word count of {file} = wc -w {file}",
+
+    "make directory {dir} = mkdir {dir}",
+    "create folder {dir} = mkdir {dir}",
+
+    "remove {file} = rm {file}",
+    "delete {file} = rm {file}",
+
+    NULL  // End of array marker
 };
 
-// Convert natural language to shell command
-char* natural_to_shell_command(const char* input) {
-    if (!input) return NULL;
-    
-    // Convert input to lowercase for case-insensitive matching
-    char* lower_input = strdup(input);
-    for (int i = 0; lower_input[i]; i++) {
-        lower_input[i] = tolower(lower_input[i]);
+typedef struct {
+    const char *command;              // Template, with {name} for the slots
+    const char *slots[NL_MAX_SLOTS];  // Slot names in pattern order
+    int slot_count;
+} Mapping;
+
+typedef struct {
+    int child;          // First literal child, -1 if none
+    int sibling;        // Next literal child of the same parent
+    int slot;           // Child reached through a {slot}, -1 if none
+    int mapping;        // Mapping whose pattern ends here, -1 if none
+    unsigned char c;    // Lowercased byte on the edge into this node
+} TrieNode;
+
+typedef struct {
+    const char *start;
+    size_t length;
+} Capture;
+
+static TrieNode *nodes = NULL;
+static int node_count = 0;
+static int node_capacity = 0;
+static Mapping *mappings = NULL;
+static int mapping_count = 0;
+static int mapping_capacity = 0;
+static Arena nl_arena;          // Mapping strings
+static int nl_loaded = 0;
+
+static int new_node(unsigned char c) {
+    if (node_count >= node_capacity) {
+        int capacity = node_capacity ? node_capacity * 2 : 64;
+        TrieNode *grown = realloc(nodes, capacity * sizeof(TrieNode));
+        if (!grown) return -1;
+        nodes = grown;
+        node_capacity = capacity;
     }
-    
-    // Try to match patterns
-    for (int i = 0; command_mappings[i].pattern != NULL; i++) {
-        size_t pattern_len = strlen(command_mappings[i].pattern);
-        if (strncmp(lower_input, command_mappings[i].pattern, pattern_len) == 0) {
-            // Allocate space for the command
-            size_t cmd_len = strlen(command_mappings[i].command);
-            size_t remaining_input = strlen(lower_input + pattern_len);
-            char* result = malloc(cmd_len + remaining_input + 2);  // +2 for space and null terminator
-            
-            if (result) {
-                strcpy(result, command_mappings[i].command);
-                // If there's remaining input after the pattern, append it
-                if (remaining_input > 0) {
-                    strcat(result, " ");
-                    strcat(result, input + pattern_len);
-                }
-                free(lower_input);
-                return result;
+    nodes[node_count] = (TrieNode){ -1, -1, -1, -1, c };
+    return node_count++;
+}
+
+static int literal_child(int node, unsigned char c) {
+    for (int i = nodes[node].child; i != -1; i = nodes[i].sibling) {
+        if (nodes[i].c == c) return i;
+    }
+    return -1;
+}
+
+// Add one "pattern = command" line. Returns -1 if it isn't one.
+static int add_mapping(const char *line) {
+    const char *equals = strchr(line, '=');
+    if (!equals) return -1;
+
+    const char *command = equals + 1;
+    while (isspace((unsigned char)*command)) command++;
+    size_t command_length = strlen(command);
+    while (command_length > 0 && isspace((unsigned char)command[command_length - 1])) {
+        command_length--;
+    }
+    if (command_length == 0) return -1;
+
+    if (mapping_count >= mapping_capacity) {
+        int capacity = mapping_capacity ? mapping_capacity * 2 : 32;
+        Mapping *grown = realloc(mappings, capacity * sizeof(Mapping));
+        if (!grown) return -1;
+        mappings = grown;
+        mapping_capacity = capacity;
+    }
+    Mapping *mapping = &mappings[mapping_count];
+    mapping->slot_count = 0;
+
+    // Walk the pattern, lowercased and with runs of spaces as one
+    int node = 0;
+    int pending_space = 0;
+    for (const char *p = line; p < equals; ) {
+        if (isspace((unsigned char)*p)) {
+            pending_space = node != 0;
+            p++;
+            continue;
+        }
+
+        if (pending_space) {
+            int next = literal_child(node, ' ');
+            if (next == -1) {
+                if ((next = new_node(' ')) == -1) return -1;
+                nodes[next].sibling = nodes[node].child;
+                nodes[node].child = next;
+            }
+            node = next;
+            pending_space = 0;
+        }
+
+        const char *close = *p == '{' ? memchr(p, '}', equals - p) : NULL;
+        if (close) {
+            if (mapping->slot_count == NL_MAX_SLOTS) return -1;
+            mapping->slots[mapping->slot_count++] = arena_strndup(&nl_arena, p + 1, close - p - 1);
+            if (nodes[node].slot == -1) {
+                int slot = new_node(0);
+                if (slot == -1) return -1;
+                nodes[node].slot = slot;
             }
+            node = nodes[node].slot;
+            p = close + 1;
+            continue;
         }
+
+        unsigned char c = tolower((unsigned char)*p++);
+        int next = literal_child(node, c);
+        if (next == -1) {
+            if ((next = new_node(c)) == -1) return -1;
+            nodes[next].sibling = nodes[node].child;
+            nodes[node].child = next;
+        }
+        node = next;
     }
-    
-    // No match found, return the original input
-    free(lower_input);
-    return strdup(input);
+    if (node == 0) return -1;
+
+    // The first mapping of a pattern wins, as in a lookup table
+    if (nodes[node].mapping != -1) return 0;
+    mapping->command = arena_strndup(&nl_arena, command, command_length);
+    if (!mapping->command) return -1;
+    nodes[node].mapping = mapping_count++;
+    return 0;
+}
+
+static char *get_nl_path() {
+    static char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    if (!home) return NULL;
+    snprintf(path, sizeof(path), "%s/%s", home, NL_FILE);
+    return path;
+}
+
+// Compile the mappings file, or the built-in table if there is none.
+// Blank lines and lines starting with '#' are skipped.
+static void load_mappings() {
+    nl_loaded = 1;
+    arena_init(&nl_arena, NL_ARENA_BLOCK);
+    if (new_node(0) == -1) return;
+
+    const char *path = get_nl_path();
+    FILE *file = path ? fopen(path, "r") : NULL;
+    if (!file) {
+        for (int i = 0; default_mappings[i]; i++) {
+            add_mapping(default_mappings[i]);
+        }
+        return;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int number = 0;
+    while (getline(&line, &size, file) != -1) {
+        number++;
+        char *text = line;
+        while (isspace((unsigned char)*text)) text++;
+        if (*text == '\0' || *text == '#') continue;
+        if (add_mapping(text) == -1) {
+            fprintf(stderr, "%s:%d: expected 'pattern = command'\n", path, number);
+        }
+    }
+    free(line);
+    fclose(file);
+}
+
+// Whether 'p' ends a word of the input
+static int at_word_end(const char *p) {
+    return *p == '\0' || isspace((unsigned char)*p);
+}
+
+// Fill in the command template; any unmatched rest of the line goes after it
+static char *build_command(const Mapping *mapping, const Capture *captures, const char *rest) {
+    size_t size = strlen(mapping->command) + strlen(rest) + 2;
+    for (int i = 0; i < mapping->slot_count; i++) size += captures[i].length;
+    char *result = malloc(size);
+    if (!result) return NULL;
+
+    size_t length = 0;
+    for (const char *p = mapping->command; *p; ) {
+        const char *close = *p == '{' ? strchr(p, '}') : NULL;
+        int slot = -1;
+        for (int i = 0; close && i < mapping->slot_count; i++) {
+            if (strlen(mapping->slots[i]) == (size_t)(close - p - 1) &&
+                strncmp(mapping->slots[i], p + 1, close - p - 1) == 0) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot == -1) {
+            result[length++] = *p++;
+            continue;
+        }
+        // A slot can appear more than once; 'size' counted it once
+        if (length + captures[slot].length + strlen(p) + strlen(rest) + 2 > size) {
+            size = (length + captures[slot].length + strlen(p) + strlen(rest) + 2) * 2;
+            char *grown = realloc(result, size);
+            if (!grown) {
+                free(result);
+                return NULL;
+            }
+            result = grown;
+        }
+        memcpy(result + length, captures[slot].start, captures[slot].length);
+        length += captures[slot].length;
+        p = close + 1;
+    }
+    if (*rest) {
+        result[length++] = ' ';
+        strcpy(result + length, rest);
+    } else {
+        result[length] = '\0';
+    }
+    return result;
+}
+
+// Rewrite a natural-language line into a shell command. Returns a new
+// string, or NULL when the line matches no mapping and runs as it is.
+char* natural_to_shell_command(const char* input) {
+    if (!input) return NULL;
+    if (!nl_loaded) load_mappings();
+    if (node_count == 0) return NULL;
+
+    Capture captures[NL_MAX_SLOTS];
+    Capture best_captures[NL_MAX_SLOTS];
+    int capture_count = 0;
+    int best = -1;
+    const char *best_end = NULL;
+
+    int node = 0;
+    const char *p = input;
+    while (isspace((unsigned char)*p)) p++;
+    for (;;) {
+        if (nodes[node].mapping != -1 && node != 0 && at_word_end(p)) {
+            best = nodes[node].mapping;
+            best_end = p;
+            memcpy(best_captures, captures, capture_count * sizeof(Capture));
+        }
+        if (*p == '\0') break;
+
+        int next;
+        if (isspace((unsigned char)*p) && (next = literal_child(node, ' ')) != -1) {
+            while (isspace((unsigned char)*p)) p++;
+            node = next;
+            continue;
+        }
+        if ((next = literal_child(node, tolower((unsigned char)*p))) != -1) {
+            p++;
+            node = next;
+            continue;
+        }
+
+        int slot = nodes[node].slot;
+        if (slot == -1 || isspace((unsigned char)*p) || capture_count == NL_MAX_SLOTS) break;
+
+        // A slot at the end of its patterns takes the rest of the line,
+        // otherwise one word
+        const char *end = p;
+        if (nodes[slot].child == -1 && nodes[slot].slot == -1) {
+            end += strlen(end);
+            while (isspace((unsigned char)end[-1])) end--;
+        } else {
+            while (!at_word_end(end)) end++;
+        }
+        captures[capture_count++] = (Capture){ p, end - p };
+        p = end;
+        node = slot;
+    }
+    if (best == -1) return NULL;
+
+    while (isspace((unsigned char)*best_end)) best_end++;
+    return build_command(&mappings[best], best_captures, best_end);
+}
+
+void free_natural_commands() {
+    if (!nl_loaded) return;
+    free(nodes);
+    free(mappings);
+    arena_free(&nl_arena);
+    nodes = NULL;
+    mappings = NULL;
+    node_count = node_capacity = 0;
+    mapping_count = mapping_capacity = 0;
+    nl_loaded = 0;
 }
@@ -1,138 +1,488 @@
 #include "shell.h"
 
-// Helper function to trim whitespace
-static char *trim(char *str) {
-    char *end;
-    while (isspace((unsigned char)*str)) str++;
-    if (*str == 0) return str;
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-    end[1] = '\0';
-    return str;
-}
-
-// Helper function to split string by delimiter
-static char **split_string(char *str, const char *delim, int *count) {
-    char **result = NULL;
-    char *token;
-    int i = 0;
-    
-    // First pass: count tokens
-    char *str_copy = strdup(str);
-    token = strtok(str_copy, delim);
-    while (token) {
-        i++;
-        token = strtok(NULL, delim);
-    }
-    free(str_copy);
-    
-    // Allocate array
-    result = malloc((i + 1) * sizeof(char *));
-    if (!result) return NULL;
-    
-    // Second pass: fill array
-    i = 0;
-    token = strtok(str, delim);
-    while (token) {
-        result[i++] = strdup(trim(token));
-        token = strtok(NULL, delim);
-    }
-    result[i] = NULL;
-    
-    if (count) *count = i;
-    return result;
-}
-
-// Initialize a new command structure
-static Command *init_command() {
-    Command *cmd = malloc(sizeof(Command));
-    if (!cmd) return NULL;
-    
-    cmd->command = NULL;
-    cmd->args = malloc((MAX_ARGS + 1) * sizeof(char *));
-    cmd->arg_count = 0;
-    cmd->input_file = NULL;
-    cmd->output_file = NULL;
-    cmd->append_output = 0;
-    
-    return cmd;
-}
-
-// Parse a single command
-static Command *parse_command(char *cmd_str) {
-    Command *cmd = init_command();
-    if (!cmd) return NULL;
-    
-    // Split command and arguments
-    char **parts = split_string(cmd_str, " \t", &cmd->arg_count);
-    if (!parts) {
-        free(cmd);
-        return NULL;
-    }
-    
-    if (cmd->arg_count > 0) {
-        cmd->command = strdup(parts[0]);
-        cmd->args[0] = strdup(parts[0]);
-        
-        for (int i = 1; i < cmd->arg_count; i++) {
-            if (strcmp(parts[i], "<") == 0) {
-                if (i + 1 < cmd->arg_count) {
-                    cmd->input_file = strdup(parts[i + 1]);
-                    i++;
-                }
-            } else if (strcmp(parts[i], ">") == 0) {
-                if (i + 1 < cmd->arg_count) {
-                    cmd->output_file = strdup(parts[i + 1]);
-                    cmd->append_output = 0;
-                    i++;
-                }
-            } else if (strcmp(parts[i], ">>") == 0) {
-                if (i + 1 < cmd->arg_count) {
-                    cmd->output_file = strdup(parts[i + 1]);
-                    cmd->append_output = 1;
-                    i++;
+#define PARSE_ARENA_BLOCK 4096
+
+// Lexer
+//
+// A single pass over the line. Words are unquoted in place: the write
+// position trails the read position, so every token is a slice of the
+// line's own buffer and nothing is allocated per token. A word is
+// terminated by writing a NUL after it; when that lands on the character
+// that ended the word (e.g. the '|' in "a|b"), the character is kept in
+// 'saved' and read from there instead.
+//
+// A '$' that starts an expansion ($?, $$, $NAME, ${NAME}) outside single
+// quotes is replaced with EXPAND_MARK; the executor expands it when the
+// command runs, so '$?' sees the status of the command before it. An
+// unquoted '~' at the start of a word, followed by a user name or nothing
+// up to a '/' or the end of the word, becomes TILDE_MARK the same way.
+
+typedef enum {
+    TOK_WORD,
+    TOK_PIPE,       // |
+    TOK_LESS,       // <
+    TOK_GREAT,      // >
+    TOK_DGREAT,     // >>
+    TOK_ERRGREAT,   // 2>
+    TOK_AND_IF,     // &&
+    TOK_OR_IF,      // ||
+    TOK_SEMI,       // ;
+    TOK_AMP,        // &
+    TOK_END,
+    TOK_ERROR       // Unterminated quote
+} TokenType;
+
+static const char *token_names[] = {
+    "word", "|", "<", ">", ">>", "2>", "&&", "||", ";", "&", "newline", "error"
+};
+
+typedef struct {
+    TokenType type;
+    char *text;     // NUL-terminated word text (TOK_WORD only)
+    int expand;     // The word contains EXPAND_MARK
+} Token;
+
+typedef struct {
+    char *pos;        // Next character to read
+    char *saved_at;   // Position overwritten by a word's terminator
+    char saved;       // The character that was there
+} Lexer;
+
+static char peek_char(Lexer *lx, int offset) {
+    char *p = lx->pos + offset;
+    return p == lx->saved_at ? lx->saved : *p;
+}
+
+static int is_operator_char(char c) {
+    return c == '|' || c == '<' || c == '>' || c == ';' || c == '&';
+}
+
+// Whether a '$' followed by 'next' starts an expansion
+static int starts_expansion(char next) {
+    return next == '?' || next == '$' || next == '{' || next == '_' || isalpha((unsigned char)next);
+}
+
+// Whether the '~' at the lexer's position starts a tilde prefix
+static int starts_tilde(Lexer *lx) {
+    for (int i = 1; ; i++) {
+        char c = peek_char(lx, i);
+        if (c == '/' || c == '\0' || isspace((unsigned char)c) || is_operator_char(c)) return 1;
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.') return 0;
+    }
+}
+
+static int lex_word(Lexer *lx, Token *tok) {
+    char *out = lx->pos;
+    tok->type = TOK_WORD;
+    tok->text = out;
+    tok->expand = 0;
+
+    if (peek_char(lx, 0) == '~' && starts_tilde(lx)) {
+        *out++ = TILDE_MARK;
+        lx->pos++;
+        tok->expand = 1;
+    }
+
+    for (;;) {
+        char c = peek_char(lx, 0);
+        if (c == '\0' || isspace((unsigned char)c) || is_operator_char(c)) break;
+
+        lx->pos++;
+        if (c == '\'') {
+            // Everything up to the closing quote is literal
+            while ((c = peek_char(lx, 0)) != '\'') {
+                if (c == '\0') return -1;
+                *out++ = c;
+                lx->pos++;
+            }
+            lx->pos++;
+        } else if (c == '"') {
+            // Backslash only escapes \ " $ and ` inside double quotes
+            while ((c = peek_char(lx, 0)) != '"') {
+                if (c == '\0') return -1;
+                char next = peek_char(lx, 1);
+                if (c == '\\' && (next == '\\' || next == '"' || next == '$' || next == '`')) {
+                    c = next;
+                    lx->pos++;
+                } else if (c == '$' && starts_expansion(next)) {
+                    c = EXPAND_MARK;
+                    tok->expand = 1;
                 }
+                *out++ = c;
+                lx->pos++;
+            }
+            lx->pos++;
+        } else if (c == '\\') {
+            c = peek_char(lx, 0);
+            if (c == '\0') break;  // Trailing backslash is dropped
+            *out++ = c;
+            lx->pos++;
+        } else if (c == '$' && starts_expansion(peek_char(lx, 0))) {
+            *out++ = EXPAND_MARK;
+            tok->expand = 1;
+        } else {
+            *out++ = c;
+        }
+    }
+
+    // Terminate the word, remembering the delimiter if it gets overwritten
+    if (out == lx->pos) {
+        lx->saved_at = out;
+        lx->saved = *out;
+    }
+    *out = '\0';
+    return 0;
+}
+
+static void next_token(Lexer *lx, Token *tok) {
+    while (isspace((unsigned char)peek_char(lx, 0))) lx->pos++;
+
+    char c = peek_char(lx, 0);
+    char next = c ? peek_char(lx, 1) : '\0';
+    int length = 1;
+    tok->text = NULL;
+
+    switch (c) {
+    case '#':
+        // A comment runs to the end of the line
+        while (peek_char(lx, 0)) lx->pos++;
+        // Fall through
+    case '\0': tok->type = TOK_END; return;
+    case ';':  tok->type = TOK_SEMI; break;
+    case '<':  tok->type = TOK_LESS; break;
+    case '|':
+        tok->type = next == '|' ? TOK_OR_IF : TOK_PIPE;
+        length = next == '|' ? 2 : 1;
+        break;
+    case '&':
+        tok->type = next == '&' ? TOK_AND_IF : TOK_AMP;
+        length = next == '&' ? 2 : 1;
+        break;
+    case '>':
+        tok->type = next == '>' ? TOK_DGREAT : TOK_GREAT;
+        length = next == '>' ? 2 : 1;
+        break;
+    case '2':
+        if (next == '>') {
+            tok->type = TOK_ERRGREAT;
+            length = 2;
+            break;
+        }
+        // Fall through
+    default:
+        if (lex_word(lx, tok) == -1) tok->type = TOK_ERROR;
+        return;
+    }
+    lx->pos += length;
+}
+
+// Parser
+//
+// Recursive descent over the token stream, one token of lookahead:
+//
+//   list     := and_or ((';' | '&') and_or)* [';' | '&']
+//   and_or   := pipeline (('&&' | '||') pipeline)*
+//   pipeline := ['time'] command ('|' command)*
+//   command  := (WORD | redirect)+
+//   redirect := ('<' | '>' | '>>' | '2>') WORD
+
+typedef struct {
+    Lexer lexer;
+    Token tok;        // Current lookahead token
+    Arena *arena;
+} Parser;
+
+static void advance(Parser *p) {
+    next_token(&p->lexer, &p->tok);
+}
+
+static void syntax_error(Parser *p) {
+    last_exit_status = 2;
+    if (p->tok.type == TOK_ERROR) {
+        fprintf(stderr, "myshell: syntax error: unterminated quote\n");
+    } else {
+        fprintf(stderr, "myshell: syntax error near unexpected token `%s'\n",
+                p->tok.type == TOK_WORD ? p->tok.text : token_names[p->tok.type]);
+    }
+}
+
+// Make room for one more element in an arena-backed array
+static void *grow_array(Arena *arena, void *items, int count, int *capacity, size_t item_size) {
+    if (count < *capacity) return items;
+    int new_capacity = *capacity ? *capacity * 2 : 8;
+    items = arena_realloc(arena, items, *capacity * item_size, new_capacity * item_size);
+    *capacity = new_capacity;
+    return items;
+}
+
+static int parse_command(Parser *p, Command *cmd) {
+    int capacity = 0;
+    memset(cmd, 0, sizeof(Command));
+
+    for (;;) {
+        TokenType type = p->tok.type;
+        if (type == TOK_WORD) {
+            // Keep room for the NULL terminator
+            cmd->args = grow_array(p->arena, cmd->args, cmd->arg_count + 1, &capacity, sizeof(char *));
+            if (!cmd->args) return -1;
+            cmd->args[cmd->arg_count++] = p->tok.text;
+            cmd->expand |= p->tok.expand;
+            advance(p);
+        } else if (type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT || type == TOK_ERRGREAT) {
+            advance(p);
+            if (p->tok.type != TOK_WORD) {
+                syntax_error(p);
+                return -1;
+            }
+            if (type == TOK_LESS) {
+                cmd->input_file = p->tok.text;
+            } else if (type == TOK_ERRGREAT) {
+                cmd->error_file = p->tok.text;
+            } else {
+                cmd->output_file = p->tok.text;
+                cmd->append_output = type == TOK_DGREAT;
+            }
+            cmd->expand |= p->tok.expand;
+            advance(p);
+        } else {
+            break;
+        }
+    }
+
+    if (cmd->arg_count == 0) {
+        syntax_error(p);
+        return -1;
+    }
+    cmd->args[cmd->arg_count] = NULL;
+    cmd->command = cmd->args[0];
+    return 0;
+}
+
+static Node *new_node(Parser *p, NodeType type, Node *left, Node *right) {
+    Node *node = arena_alloc(p->arena, sizeof(Node));
+    if (!node) return NULL;
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->pipeline = NULL;
+    return node;
+}
+
+static Node *parse_pipeline(Parser *p) {
+    Pipeline *pipeline = arena_alloc(p->arena, sizeof(Pipeline));
+    Node *node = new_node(p, NODE_PIPELINE, NULL, NULL);
+    if (!pipeline || !node) return NULL;
+    pipeline->commands = NULL;
+    pipeline->command_count = 0;
+    pipeline->timed = 0;
+    node->pipeline = pipeline;
+
+    // 'time' times the whole pipeline; on its own it reports zero
+    if (p->tok.type == TOK_WORD && strcmp(p->tok.text, "time") == 0) {
+        pipeline->timed = 1;
+        advance(p);
+        TokenType type = p->tok.type;
+        if (type == TOK_END || type == TOK_SEMI || type == TOK_AMP ||
+            type == TOK_AND_IF || type == TOK_OR_IF) {
+            return node;
+        }
+    }
+
+    int capacity = 0;
+    for (;;) {
+        pipeline->commands = grow_array(p->arena, pipeline->commands, pipeline->command_count,
+                                        &capacity, sizeof(Command));
+        if (!pipeline->commands ||
+            parse_command(p, &pipeline->commands[pipeline->command_count]) == -1) {
+            return NULL;
+        }
+        pipeline->command_count++;
+
+        if (p->tok.type != TOK_PIPE) return node;
+        advance(p);
+    }
+}
+
+static Node *parse_and_or(Parser *p) {
+    Node *node = parse_pipeline(p);
+    while (node && (p->tok.type == TOK_AND_IF || p->tok.type == TOK_OR_IF)) {
+        NodeType type = p->tok.type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        advance(p);
+        Node *right = parse_pipeline(p);
+        node = right ? new_node(p, type, node, right) : NULL;
+    }
+    return node;
+}
+
+static Node *parse_list(Parser *p) {
+    Node *list = NULL;
+    for (;;) {
+        Node *node = parse_and_or(p);
+        if (node && p->tok.type == TOK_AMP) {
+            node = new_node(p, NODE_BACKGROUND, node, NULL);
+        }
+        if (!node) return NULL;
+        list = list ? new_node(p, NODE_SEQUENCE, list, node) : node;
+        if (!list) return NULL;
+
+        if (p->tok.type != TOK_SEMI && p->tok.type != TOK_AMP) return list;
+        advance(p);
+        if (p->tok.type == TOK_END) return list;  // Trailing ';' or '&'
+    }
+}
+
+// Parse one input line. *result is NULL for a blank line. Returns -1
+// (after reporting it) on a syntax error.
+int parse_line(const char *line, CommandLine **result) {
+    *result = NULL;
+
+    // The tree lives in its own arena, together with a private copy of the
+    // line that the lexer unquotes in place
+    Arena arena;
+    arena_init(&arena, PARSE_ARENA_BLOCK);
+    CommandLine *tree = arena_alloc(&arena, sizeof(CommandLine));
+    char *copy = tree ? arena_strndup(&arena, line, strlen(line)) : NULL;
+    if (!copy) {
+        perror("malloc");
+        arena_free(&arena);
+        return -1;
+    }
+
+    Parser parser = { .lexer = { copy, NULL, '\0' }, .arena = &arena };
+    advance(&parser);
+    if (parser.tok.type == TOK_END) {  // Blank line or comment
+        arena_free(&arena);
+        return 0;
+    }
+
+    tree->root = parse_list(&parser);
+    if (tree->root && parser.tok.type != TOK_END) {
+        syntax_error(&parser);
+        tree->root = NULL;
+    }
+    if (!tree->root) {
+        arena_free(&arena);
+        return -1;
+    }
+
+    tree->arena = arena;
+    *result = tree;
+    return 0;
+}
+
+void free_command_line(CommandLine *line) {
+    // The line is inside its own arena, so copy the arena out first
+    Arena arena = line->arena;
+    arena_free(&arena);
+}
+
+// Turning a tree back into text, for job listings
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+static void append_text(TextBuffer *buf, const char *text) {
+    size_t len = strlen(text);
+    if (buf->length + len + 1 > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 64;
+        while (buf->length + len + 1 > capacity) capacity *= 2;
+        char *data = realloc(buf->data, capacity);
+        if (!data) return;
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->length, text, len + 1);
+    buf->length += len;
+}
+
+static void append_word(TextBuffer *buf, const char *word) {
+    if (*word == TILDE_MARK) {
+        // The tilde prefix stays unquoted so it still expands
+        size_t len = strcspn(word + 1, "/");
+        append_text(buf, "~");
+        for (size_t i = 1; i <= len; i++) {
+            char c[2] = { word[i], '\0' };
+            append_text(buf, c);
+        }
+        if (word[len + 1]) append_word(buf, word + len + 1);
+        return;
+    }
+    int expands = strchr(word, EXPAND_MARK) != NULL;
+    if (*word && strpbrk(word, " \t'\"\\|&;<>$") == NULL) {
+        for (const char *p = word; *p; p++) {
+            char c[2] = { *p == EXPAND_MARK ? '$' : *p, '\0' };
+            append_text(buf, c);
+        }
+        return;
+    }
+    if (expands) {
+        // Double quotes keep the expansions; anything else special is escaped
+        append_text(buf, "\"");
+        for (const char *p = word; *p; p++) {
+            char c[3] = { '\\', *p, '\0' };
+            if (*p == EXPAND_MARK) {
+                append_text(buf, "$");
             } else {
-                cmd->args[i] = strdup(parts[i]);
+                append_text(buf, strchr("\"\\$`", *p) ? c : c + 1);
             }
         }
-        cmd->args[cmd->arg_count] = NULL;
-    }
-    
-    // Free temporary array
-    for (int i = 0; parts[i]; i++) {
-        free(parts[i]);
-    }
-    free(parts);
-    
-    return cmd;
-}
-
-Pipeline *parse_line(char *line) {
-    if (!line || strlen(line) == 0) return NULL;
-    
-    // Split by pipe
-    int pipe_count;
-    char **pipe_parts = split_string(line, "|", &pipe_count);
-    if (!pipe_parts) return NULL;
-    
-    // Create pipeline
-    Pipeline *pipeline = malloc(sizeof(Pipeline));
-    if (!pipeline) {
-        for (int i = 0; pipe_parts[i]; i++) free(pipe_parts[i]);
-        free(pipe_parts);
-        return NULL;
-    }
-    
-    pipeline->commands = malloc(pipe_count * sizeof(Command));
-    pipeline->command_count = pipe_count;
-    
-    // Parse each command
-    for (int i = 0; i < pipe_count; i++) {
-        pipeline->commands[i] = *parse_command(pipe_parts[i]);
-        free(pipe_parts[i]);
-    }
-    free(pipe_parts);
-    
-    return pipeline;
-} 
\ No newline at end of file
+        append_text(buf, "\"");
+        return;
+    }
+    // Quote it; a ' inside becomes '\''
+    append_text(buf, "'");
+    for (const char *p = word; *p; p++) {
+        char c[2] = { *p, '\0' };
+        append_text(buf, *p == '\'' ? "'\\''" : c);
+    }
+    append_text(buf, "'");
+}
+
+static void append_command(TextBuffer *buf, Command *cmd) {
+    for (int i = 0; i < cmd->arg_count; i++) {
+        if (i > 0) append_text(buf, " ");
+        append_word(buf, cmd->args[i]);
+    }
+    const char *ops[3] = { " < ", cmd->append_output ? " >> " : " > ", " 2> " };
+    const char *files[3] = { cmd->input_file, cmd->output_file, cmd->error_file };
+    for (int i = 0; i < 3; i++) {
+        if (!files[i]) continue;
+        append_text(buf, ops[i]);
+        append_word(buf, files[i]);
+    }
+}
+
+static void append_node(TextBuffer *buf, Node *node) {
+    switch (node->type) {
+    case NODE_PIPELINE:
+        if (node->pipeline->timed) {
+            append_text(buf, node->pipeline->command_count ? "time " : "time");
+        }
+        for (int i = 0; i < node->pipeline->command_count; i++) {
+            if (i > 0) append_text(buf, " | ");
+            append_command(buf, &node->pipeline->commands[i]);
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQUENCE:
+        append_node(buf, node->left);
+        append_text(buf, node->type == NODE_AND ? " && " : node->type == NODE_OR ? " || " : "; ");
+        append_node(buf, node->right);
+        break;
+    case NODE_BACKGROUND:
+        append_node(buf, node->left);
+        append_text(buf, " &");
+        break;
+    }
+}
+
+// Text of a node as it could be typed back in (malloc'd)
+char *format_node(Node *node) {
+    TextBuffer buf = { NULL, 0, 0 };
+    append_node(&buf, node);
+    return buf.data ? buf.data : strdup("");
+}
@@ -0,0 +1,276 @@
+#include "shell.h"
+#include <dirent.h>
+#include <time.h>
+
+#define PATH_CACHE_ARENA_BLOCK (64 * 1024)
+#define PATH_CACHE_RECHECK_SECONDS 1  // Trust the cache this long between mtime checks
+
+// Executables found on $PATH, indexed by name. The first directory in
+// $PATH that has a name wins, as with execvp.
+typedef struct {
+    const char *name;
+    const char *path;  // Absolute path
+    int hits;          // Times looked up for execution
+} PathEntry;
+
+// A $PATH directory and its mtime when it was scanned
+typedef struct {
+    const char *dir;
+    struct timespec mtime;
+    int exists;
+} PathDir;
+
+static Arena cache_arena;
+static PathEntry *entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+static int *slots = NULL;          // Open addressing, entry index + 1
+static int slot_count = 0;
+static int *sorted = NULL;         // Entry indices sorted by name, for prefix queries
+static int sorted_valid = 0;
+static PathDir *dirs = NULL;
+static int dir_count = 0;
+static char *scanned_path = NULL;  // $PATH the cache was built from
+static int cache_built = 0;
+static time_t last_check = 0;
+
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h;
+}
+
+static int *find_slot(const char *name) {
+    unsigned int i = hash_name(name) & (slot_count - 1);
+    while (slots[i] && strcmp(entries[slots[i] - 1].name, name) != 0) {
+        i = (i + 1) & (slot_count - 1);
+    }
+    return &slots[i];
+}
+
+static void grow_slots() {
+    int new_count = slot_count ? slot_count * 2 : 4096;
+    free(slots);
+    slots = calloc(new_count, sizeof(int));
+    slot_count = slots ? new_count : 0;
+    for (int i = 0; slots && i < entry_count; i++) {
+        *find_slot(entries[i].name) = i + 1;
+    }
+}
+
+static void add_entry(const char *dir, const char *name) {
+    if ((entry_count + 1) * 2 > slot_count) {
+        grow_slots();
+        if (!slot_count) return;
+    }
+    
+    int *slot = find_slot(name);
+    if (*slot) return;  // An earlier $PATH directory already provides it
+    
+    if (entry_count >= entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 1024;
+        entries = realloc(entries, entry_capacity * sizeof(PathEntry));
+    }
+    
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *path = arena_alloc(&cache_arena, dir_len + name_len + 2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    
+    entries[entry_count].path = path;
+    entries[entry_count].name = path + dir_len + 1;
+    entries[entry_count].hits = 0;
+    *slot = ++entry_count;
+}
+
+static void clear_cache() {
+    arena_free(&cache_arena);
+    free(entries);
+    free(slots);
+    free(sorted);
+    free(dirs);
+    free(scanned_path);
+    entries = NULL;
+    slots = NULL;
+    sorted = NULL;
+    dirs = NULL;
+    scanned_path = NULL;
+    entry_count = entry_capacity = slot_count = dir_count = 0;
+    sorted_valid = 0;
+    cache_built = 0;
+}
+
+static void scan_dir(PathDir *pd) {
+    struct stat st;
+    pd->exists = stat(pd->dir, &st) == 0 && S_ISDIR(st.st_mode);
+    if (!pd->exists) return;
+    pd->mtime = st.st_mtim;
+    
+    DIR *d = opendir(pd->dir);
+    if (!d) return;
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' &&
+            (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        // Only executable files are commands (symlinks are followed)
+        if (entry->d_type == DT_DIR) continue;
+        struct stat target;
+        if (fstatat(dirfd(d), entry->d_name, &target, 0) == -1 || !S_ISREG(target.st_mode) ||
+            !(target.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+            continue;
+        }
+        add_entry(pd->dir, entry->d_name);
+    }
+    closedir(d);
+}
+
+static void build_cache() {
+    double started = profile_clock();
+    clear_cache();
+    arena_init(&cache_arena, PATH_CACHE_ARENA_BLOCK);
+    
+    const char *path = getenv("PATH");
+    scanned_path = strdup(path ? path : "");
+    
+    // One PathDir per $PATH element; empty elements mean the current
+    // directory, which changes too often to cache and is skipped
+    int max_dirs = 1;
+    for (const char *p = scanned_path; *p; p++) {
+        if (*p == ':') max_dirs++;
+    }
+    dirs = calloc(max_dirs, sizeof(PathDir));
+    
+    const char *start = scanned_path;
+    while (dirs) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        if (len > 0) {
+            dirs[dir_count].dir = arena_strndup(&cache_arena, start, len);
+            scan_dir(&dirs[dir_count]);
+            dir_count++;
+        }
+        if (!end) break;
+        start = end + 1;
+    }
+    
+    cache_built = 1;
+    last_check = time(NULL);
+    profile_record("command index", started);
+}
+
+// Whether $PATH or any of its directories changed since the scan
+static int cache_stale() {
+    const char *path = getenv("PATH");
+    if (strcmp(scanned_path, path ? path : "") != 0) return 1;
+    
+    for (int i = 0; i < dir_count; i++) {
+        struct stat st;
+        int exists = stat(dirs[i].dir, &st) == 0 && S_ISDIR(st.st_mode);
+        if (exists != dirs[i].exists) return 1;
+        if (exists && (st.st_mtim.tv_sec != dirs[i].mtime.tv_sec ||
+                       st.st_mtim.tv_nsec != dirs[i].mtime.tv_nsec)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Build the cache on first use; afterwards rescan when it went stale.
+// 'force' checks now instead of at most once per PATH_CACHE_RECHECK_SECONDS.
+static void validate_cache(int force) {
+    if (!cache_built) {
+        build_cache();
+        return;
+    }
+    
+    time_t now = time(NULL);
+    if (!force && now - last_check < PATH_CACHE_RECHECK_SECONDS) return;
+    last_check = now;
+    if (cache_stale()) build_cache();
+}
+
+static PathEntry *lookup_entry(const char *name) {
+    validate_cache(0);
+    int *slot = slot_count ? find_slot(name) : NULL;
+    if (!slot || !*slot) {
+        // A miss may be a new executable: check the directories right away
+        validate_cache(1);
+        slot = slot_count ? find_slot(name) : NULL;
+    }
+    return slot && *slot ? &entries[*slot - 1] : NULL;
+}
+
+// Absolute path of the executable 'name' would run, or NULL
+const char *path_cache_lookup(const char *name) {
+    PathEntry *entry = lookup_entry(name);
+    if (!entry) return NULL;
+    entry->hits++;
+    return entry->path;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(entries[*(const int *)a].name, entries[*(const int *)b].name);
+}
+
+// The index-th executable (in name order) starting with 'prefix', or NULL
+const char *path_cache_complete(const char *prefix, int index) {
+    if (index == 0) validate_cache(0);
+    
+    if (!sorted_valid) {
+        free(sorted);
+        sorted = malloc(entry_count * sizeof(int) + 1);
+        if (!sorted) return NULL;
+        for (int i = 0; i < entry_count; i++) sorted[i] = i;
+        qsort(sorted, entry_count, sizeof(int), compare_entries);
+        sorted_valid = 1;
+    }
+    
+    // Binary search for the first name >= prefix
+    size_t len = strlen(prefix);
+    int lo = 0, hi = entry_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(entries[sorted[mid]].name, prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    int i = lo + index;
+    if (i < entry_count && strncmp(entries[sorted[i]].name, prefix, len) == 0) {
+        return entries[sorted[i]].name;
+    }
+    return NULL;
+}
+
+void path_cache_rehash() {
+    clear_cache();
+}
+
+// Print the hashed commands: those used so far, or 'name's entry
+int path_cache_print(const char *name) {
+    if (name) {
+        PathEntry *entry = lookup_entry(name);
+        if (!entry) return -1;
+        printf("%s\n", entry->path);
+        return 0;
+    }
+    
+    int shown = 0;
+    for (int i = 0; i < entry_count; i++) {
+        if (entries[i].hits == 0) continue;
+        if (!shown++) printf("hits\tcommand\n");
+        printf("%4d\t%s\n", entries[i].hits, entries[i].path);
+    }
+    if (!shown) printf("hash: hash table empty\n");
+    return 0;
+}
+
+void free_path_cache() {
+    clear_cache();
+}
@@ -0,0 +1,376 @@
+#include "shell.h"
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+// pinfo: process inspector built on /proc
+//
+// Every file of /proc/<pid> that is sampled is opened once, relative to a
+// directory fd for the process, and re-read with pread() at offset 0; the
+// kernel regenerates the contents on each read. Watch mode (-w) samples
+// the same fds over and over, so each tick costs one pread per file and
+// one getdents pass over fd/.
+
+#define PROC_BUFFER_SIZE 4096
+
+enum { PROC_STAT, PROC_SMAPS, PROC_IO, PROC_SYSCALL, PROC_FILE_COUNT };
+
+static const char *proc_file_names[PROC_FILE_COUNT] = {
+    "stat", "smaps_rollup", "io", "syscall"
+};
+
+typedef struct {
+    pid_t pid;
+    int dir_fd;                  // /proc/<pid>
+    int fds[PROC_FILE_COUNT];    // -1 where the file can't be read
+    DIR *fd_dir;                 // /proc/<pid>/fd
+    char buf[PROC_BUFFER_SIZE];
+} ProcFiles;
+
+typedef struct {
+    char name[64];
+    char state;
+    pid_t ppid;
+    long threads;
+    unsigned long long utime, stime;     // Clock ticks
+    long long cutime, cstime;            // Waited-for children, clock ticks
+    unsigned long vsize;                 // Bytes
+    long rss_kb, pss_kb, swap_kb;        // -1 if unavailable
+    long long rchar, wchar;              // Bytes through read/write; -1 if unavailable
+    long long read_bytes, write_bytes;   // Bytes from/to storage
+    int fd_count;                        // -1 if unavailable
+    char syscall[32];
+} ProcSample;
+
+// Names of the syscalls a process is most often found blocked in
+#define SYSCALL_ENTRY(name) { SYS_##name, #name }
+static const struct {
+    long number;
+    const char *name;
+} syscall_names[] = {
+    SYSCALL_ENTRY(read), SYSCALL_ENTRY(write), SYSCALL_ENTRY(pread64), SYSCALL_ENTRY(wait4),
+    SYSCALL_ENTRY(nanosleep), SYSCALL_ENTRY(clock_nanosleep), SYSCALL_ENTRY(futex),
+    SYSCALL_ENTRY(ppoll), SYSCALL_ENTRY(pselect6), SYSCALL_ENTRY(epoll_pwait),
+    SYSCALL_ENTRY(accept4), SYSCALL_ENTRY(connect), SYSCALL_ENTRY(recvfrom),
+    SYSCALL_ENTRY(sendto), SYSCALL_ENTRY(recvmsg), SYSCALL_ENTRY(sendmsg),
+    SYSCALL_ENTRY(openat), SYSCALL_ENTRY(close), SYSCALL_ENTRY(waitid),
+    SYSCALL_ENTRY(rt_sigsuspend), SYSCALL_ENTRY(rt_sigtimedwait), SYSCALL_ENTRY(splice),
+    SYSCALL_ENTRY(fsync), SYSCALL_ENTRY(fdatasync), SYSCALL_ENTRY(flock),
+#ifdef SYS_poll
+    SYSCALL_ENTRY(poll),
+#endif
+#ifdef SYS_select
+    SYSCALL_ENTRY(select),
+#endif
+#ifdef SYS_epoll_wait
+    SYSCALL_ENTRY(epoll_wait),
+#endif
+#ifdef SYS_accept
+    SYSCALL_ENTRY(accept),
+#endif
+#ifdef SYS_pause
+    SYSCALL_ENTRY(pause),
+#endif
+};
+
+static int open_proc_files(ProcFiles *pf, pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d", (int)pid);
+    pf->pid = pid;
+    pf->fd_dir = NULL;
+    for (int i = 0; i < PROC_FILE_COUNT; i++) pf->fds[i] = -1;
+    pf->dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pf->dir_fd == -1) return -1;
+
+    for (int i = 0; i < PROC_FILE_COUNT; i++) {
+        pf->fds[i] = openat(pf->dir_fd, proc_file_names[i], O_RDONLY | O_CLOEXEC);
+    }
+    int fd_dir = openat(pf->dir_fd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    pf->fd_dir = fd_dir != -1 ? fdopendir(fd_dir) : NULL;
+    if (!pf->fd_dir && fd_dir != -1) close(fd_dir);
+
+    if (pf->fds[PROC_STAT] == -1) {
+        errno = ESRCH;
+        return -1;
+    }
+    return 0;
+}
+
+static void close_proc_files(ProcFiles *pf) {
+    for (int i = 0; i < PROC_FILE_COUNT; i++) {
+        if (pf->fds[i] != -1) close(pf->fds[i]);
+    }
+    if (pf->fd_dir) closedir(pf->fd_dir);
+    if (pf->dir_fd != -1) close(pf->dir_fd);
+}
+
+// Read one of the files into pf->buf. Returns NULL if it can't be read.
+static char *read_proc_file(ProcFiles *pf, int file) {
+    if (pf->fds[file] == -1) return NULL;
+    ssize_t n;
+    while ((n = pread(pf->fds[file], pf->buf, sizeof(pf->buf) - 1, 0)) == -1 && errno == EINTR);
+    if (n < 0) return NULL;
+    pf->buf[n] = '\0';
+    return pf->buf;
+}
+
+// Value of a "Key: value" line, or -1
+static long long find_field(const char *text, const char *key) {
+    size_t len = strlen(key);
+    for (const char *line = text; line; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (strncmp(line, key, len) == 0 && line[len] == ':') {
+            return strtoll(line + len + 1, NULL, 10);
+        }
+    }
+    return -1;
+}
+
+// /proc/<pid>/stat: the name is in parentheses and may itself contain
+// spaces and ')', so the fields are parsed from the last ')'
+static int parse_stat(char *text, ProcSample *s) {
+    char *open = strchr(text, '(');
+    char *close = strrchr(text, ')');
+    if (!open || !close || close < open) return -1;
+
+    size_t name_len = close - open - 1;
+    if (name_len >= sizeof(s->name)) name_len = sizeof(s->name) - 1;
+    memcpy(s->name, open + 1, name_len);
+    s->name[name_len] = '\0';
+
+    // Fields 3 onwards, numbered as in proc(5)
+    char *fields[53] = { NULL };
+    int count = 3;
+    char *save;
+    for (char *f = strtok_r(close + 1, " \n", &save); f && count < 53;
+         f = strtok_r(NULL, " \n", &save)) {
+        fields[count++] = f;
+    }
+    if (count <= 23) return -1;
+
+    s->state = fields[3][0];
+    s->ppid = atoi(fields[4]);
+    s->utime = strtoull(fields[14], NULL, 10);
+    s->stime = strtoull(fields[15], NULL, 10);
+    s->cutime = strtoll(fields[16], NULL, 10);
+    s->cstime = strtoll(fields[17], NULL, 10);
+    s->threads = atol(fields[20]);
+    s->vsize = strtoul(fields[23], NULL, 10);
+    return 0;
+}
+
+static void parse_syscall(const char *text, ProcSample *s) {
+    if (!text) {
+        strcpy(s->syscall, "n/a");
+        return;
+    }
+    if (strncmp(text, "running", 7) == 0) {
+        strcpy(s->syscall, "running");
+        return;
+    }
+    long number = strtol(text, NULL, 10);
+    if (number < 0) {
+        strcpy(s->syscall, "none");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(syscall_names) / sizeof(syscall_names[0]); i++) {
+        if (syscall_names[i].number == number) {
+            snprintf(s->syscall, sizeof(s->syscall), "%s", syscall_names[i].name);
+            return;
+        }
+    }
+    snprintf(s->syscall, sizeof(s->syscall), "syscall %ld", number);
+}
+
+static int count_fds(ProcFiles *pf) {
+    if (!pf->fd_dir) return -1;
+    rewinddir(pf->fd_dir);
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(pf->fd_dir)) != NULL) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    return count;
+}
+
+// Take one sample. Returns -1 once the process is gone.
+static int sample_process(ProcFiles *pf, ProcSample *s) {
+    memset(s, 0, sizeof(*s));
+    char *text = read_proc_file(pf, PROC_STAT);
+    if (!text || parse_stat(text, s) == -1) return -1;
+
+    s->rss_kb = s->pss_kb = s->swap_kb = -1;
+    if ((text = read_proc_file(pf, PROC_SMAPS))) {
+        s->rss_kb = find_field(text, "Rss");
+        s->pss_kb = find_field(text, "Pss");
+        s->swap_kb = find_field(text, "Swap");
+    }
+
+    s->rchar = s->wchar = s->read_bytes = s->write_bytes = -1;
+    if ((text = read_proc_file(pf, PROC_IO))) {
+        s->rchar = find_field(text, "rchar");
+        s->wchar = find_field(text, "wchar");
+        s->read_bytes = find_field(text, "read_bytes");
+        s->write_bytes = find_field(text, "write_bytes");
+    }
+
+    parse_syscall(read_proc_file(pf, PROC_SYSCALL), s);
+    s->fd_count = count_fds(pf);
+    return 0;
+}
+
+static void format_kb(char *out, size_t size, long kb) {
+    if (kb < 0) {
+        snprintf(out, size, "n/a");
+    } else {
+        snprintf(out, size, "%ld kB", kb);
+    }
+}
+
+static void print_process(ProcFiles *pf, const ProcSample *s) {
+    double tick = sysconf(_SC_CLK_TCK);
+    char exe_path[PATH_MAX];
+    ssize_t len = readlinkat(pf->dir_fd, "exe", exe_path, sizeof(exe_path) - 1);
+    if (len != -1) {
+        exe_path[len] = '\0';
+    } else {
+        strcpy(exe_path, "Unknown");
+    }
+    char rss[32], pss[32], swap[32];
+    format_kb(rss, sizeof(rss), s->rss_kb);
+    format_kb(pss, sizeof(pss), s->pss_kb);
+    format_kb(swap, sizeof(swap), s->swap_kb);
+
+    printf("pid -- %d\n", pf->pid);
+    printf("Name -- %s\n", s->name);
+    printf("Parent pid -- %d\n", s->ppid);
+    printf("Process Status -- %c\n", s->state);
+    printf("memory -- %lu\n", s->vsize);
+    printf("RSS -- %s\n", rss);
+    printf("PSS -- %s\n", pss);
+    printf("Swap -- %s\n", swap);
+    printf("Threads -- %ld\n", s->threads);
+    printf("CPU Time -- user %.2fs, sys %.2fs (children: user %.2fs, sys %.2fs)\n",
+           s->utime / tick, s->stime / tick, s->cutime / tick, s->cstime / tick);
+    if (s->rchar >= 0) {
+        printf("I/O -- read %lld bytes (%lld from storage), written %lld bytes (%lld to storage)\n",
+               s->rchar, s->read_bytes, s->wchar, s->write_bytes);
+    } else {
+        printf("I/O -- n/a\n");
+    }
+    if (s->fd_count >= 0) {
+        printf("Open FDs -- %d\n", s->fd_count);
+    } else {
+        printf("Open FDs -- n/a\n");
+    }
+    printf("Syscall -- %s\n", s->syscall);
+    printf("Executable Path -- %s\n", exe_path);
+}
+
+// Watch mode stops on Ctrl+C without the shell's prompt-redrawing handler
+static volatile sig_atomic_t watch_interrupted = 0;
+
+static void handle_watch_sigint(int sig) {
+    (void)sig;
+    watch_interrupted = 1;
+}
+
+static int watch_process(ProcFiles *pf, double interval) {
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_watch_sigint;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+    watch_interrupted = 0;
+
+    double tick = sysconf(_SC_CLK_TCK);
+    struct timespec delay = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+    ProcSample prev, cur;
+    int have_prev = 0;
+    int status = 0;
+
+    printf("%8s %5s %10s %10s %4s %6s %9s %9s %11s %11s %4s  %s\n", "time", "state", "rss_kB",
+           "pss_kB", "thr", "cpu%", "user_s", "sys_s", "read_B/s", "write_B/s", "fds", "syscall");
+    while (!watch_interrupted) {
+        if (sample_process(pf, &cur) == -1 || cur.state == 'Z') {
+            printf("pinfo: process %d exited\n", pf->pid);
+            break;
+        }
+
+        double cpu = 0, read_rate = 0, write_rate = 0;
+        if (have_prev) {
+            cpu = 100.0 * ((cur.utime + cur.stime) - (prev.utime + prev.stime)) / tick / interval;
+            if (cur.rchar >= 0) {
+                read_rate = (cur.rchar - prev.rchar) / interval;
+                write_rate = (cur.wchar - prev.wchar) / interval;
+            }
+        }
+
+        char clock_text[16];
+        time_t now = time(NULL);
+        strftime(clock_text, sizeof(clock_text), "%H:%M:%S", localtime(&now));
+        printf("%8s %5c %10ld %10ld %4ld %6.1f %9.2f %9.2f %11.0f %11.0f %4d  %s\n",
+               clock_text, cur.state, cur.rss_kb, cur.pss_kb, cur.threads, cpu,
+               cur.utime / tick, cur.stime / tick, read_rate, write_rate, cur.fd_count,
+               cur.syscall);
+        if (fflush(stdout) == EOF) {
+            status = 1;  // Reader went away
+            break;
+        }
+
+        prev = cur;
+        have_prev = 1;
+        if (nanosleep(&delay, NULL) == -1 && errno != EINTR) break;
+    }
+
+    sigaction(SIGINT, &old_sa, NULL);
+    return watch_interrupted ? 128 + SIGINT : status;
+}
+
+// Whether pinfo runs until Ctrl+C instead of printing once
+int pinfo_watches(const Command *cmd) {
+    for (int i = 1; i < cmd->arg_count; i++) {
+        if (strcmp(cmd->args[i], "-w") == 0) return 1;
+    }
+    return 0;
+}
+
+int builtin_pinfo(Command *cmd) {
+    double interval = 0;
+    pid_t pid = getpid();
+    for (int i = 1; i < cmd->arg_count; i++) {
+        if (strcmp(cmd->args[i], "-w") == 0) {
+            char *end = NULL;
+            interval = i + 1 < cmd->arg_count ? strtod(cmd->args[++i], &end) : 0;
+            if (!end || *end || interval <= 0) {
+                fprintf(stderr, "pinfo: -w needs an interval in seconds\n");
+                return 2;
+            }
+        } else {
+            pid = atoi(cmd->args[i]);
+        }
+    }
+
+    ProcFiles pf;
+    if (open_proc_files(&pf, pid) == -1) {
+        fprintf(stderr, "pinfo: %d: %s\n", (int)pid, strerror(errno));
+        close_proc_files(&pf);
+        return 1;
+    }
+
+    int status = 0;
+    if (interval > 0) {
+        status = watch_process(&pf, interval);
+    } else {
+        ProcSample sample;
+        if (sample_process(&pf, &sample) == 0) {
+            print_process(&pf, &sample);
+        } else {
+            fprintf(stderr, "pinfo: %d: process exited\n", (int)pid);
+            status = 1;
+        }
+    }
+    close_proc_files(&pf);
+    return status;
+}
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include <pthread.h>
+#include <limits.h>  // For PATH_MAX
+
+// Prompt rendering
+//
+// The prompt is a row of segments, chosen and ordered by $MYSHELL_PROMPT
+// (default "status duration cwd git"). A segment's text is kept until an
+// event it depends on happens: cd, or a command line finishing. The git
+// segment reads the repository on a worker thread instead; until a fresh
+// result arrives the prompt shows the last one for the same directory, and
+// the readline event hook redraws the prompt when it does.
+
+#define DEFAULT_PROMPT_SEGMENTS "status duration cwd git"
+#define DURATION_THRESHOLD_MS 2000   // Shorter commands show no duration
+#define SEGMENT_SIZE (PATH_MAX + 64)
+#define GIT_DIRTY_LIMIT 4096         // Output read from 'git status' at most
+
+#define PROMPT_GIT 4   // A new git result arrived (internal event)
+#define PROMPT_ALL (PROMPT_CWD | PROMPT_COMMAND | PROMPT_GIT)
+
+// Colors, wrapped in \001...\002 so readline knows they take no space
+#define PROMPT_RESET "\001\033[0m\002"
+#define PROMPT_GREEN "\001\033[1;32m\002"
+#define PROMPT_RED "\001\033[1;31m\002"
+#define PROMPT_YELLOW "\001\033[33m\002"
+#define PROMPT_CYAN "\001\033[36m\002"
+
+typedef struct {
+    const char *name;
+    int events;                               // Events that make the text stale
+    void (*render)(char *out, size_t size);
+} Segment;
+
+static void render_status(char *out, size_t size);
+static void render_duration(char *out, size_t size);
+static void render_cwd(char *out, size_t size);
+static void render_git(char *out, size_t size);
+
+static const Segment segments[] = {
+    {"status", PROMPT_COMMAND, render_status},
+    {"duration", PROMPT_COMMAND, render_duration},
+    {"cwd", PROMPT_CWD, render_cwd},
+    {"git", PROMPT_ALL, render_git},
+};
+#define SEGMENT_COUNT ((int)(sizeof(segments) / sizeof(segments[0])))
+
+static int order[SEGMENT_COUNT];    // Enabled segments, in prompt order
+static int order_count = -1;        // -1 until $MYSHELL_PROMPT is read
+static int git_enabled = 0;
+static char segment_text[SEGMENT_COUNT][SEGMENT_SIZE];
+static int pending_events = PROMPT_ALL;
+static char *prompt = NULL;
+
+static char current_dir[PATH_MAX];
+static int last_status = 0;
+static double last_duration_ms = 0;
+
+// Git worker state, under git_lock
+static pthread_t git_thread;
+static int git_running = 0;
+static int git_stop = 0;
+static pthread_mutex_t git_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t git_cond = PTHREAD_COND_INITIALIZER;
+static char *git_request = NULL;        // Directory to look at next
+static unsigned int git_request_gen = 0;
+static char *git_result_dir = NULL;     // Directory the result is for
+static char *git_result = NULL;         // Segment text, "" outside a repository
+static int git_redraw = 0;              // Result not shown yet
+static pid_t git_pid = 0;               // Running 'git status', if any
+
+static void parse_segments() {
+    const char *names = getenv("MYSHELL_PROMPT");
+    if (!names) names = DEFAULT_PROMPT_SEGMENTS;
+
+    order_count = 0;
+    for (const char *p = names; *p; ) {
+        size_t length = strcspn(p, " \t,");
+        for (int i = 0; length > 0 && i < SEGMENT_COUNT; i++) {
+            if (strlen(segments[i].name) == length && strncmp(segments[i].name, p, length) == 0 &&
+                order_count < SEGMENT_COUNT) {
+                order[order_count++] = i;
+                if (segments[i].render == render_git) git_enabled = 1;
+                break;
+            }
+        }
+        p += length;
+        p += strspn(p, " \t,");
+    }
+}
+
+static void render_status(char *out, size_t size) {
+    if (last_status == 0) {
+        out[0] = '\0';
+        return;
+    }
+    snprintf(out, size, PROMPT_RED "[%d]" PROMPT_RESET, last_status);
+}
+
+static void render_duration(char *out, size_t size) {
+    if (last_duration_ms < DURATION_THRESHOLD_MS) {
+        out[0] = '\0';
+        return;
+    }
+    double seconds = last_duration_ms / 1000;
+    if (seconds < 60) {
+        snprintf(out, size, PROMPT_YELLOW "%.1fs" PROMPT_RESET, seconds);
+    } else {
+        int minutes = (int)(seconds / 60);
+        snprintf(out, size, PROMPT_YELLOW "%dm%02ds" PROMPT_RESET, minutes,
+                 (int)(seconds - minutes * 60));
+    }
+}
+
+// The working directory, with $HOME shown as ~
+static void render_cwd(char *out, size_t size) {
+    const char *home = getenv("HOME");
+    size_t home_length = home ? strlen(home) : 0;
+    if (home_length > 1 && strncmp(current_dir, home, home_length) == 0 &&
+        (current_dir[home_length] == '/' || current_dir[home_length] == '\0')) {
+        snprintf(out, size, PROMPT_GREEN "~%s" PROMPT_RESET, current_dir + home_length);
+    } else {
+        snprintf(out, size, PROMPT_GREEN "%s" PROMPT_RESET, current_dir);
+    }
+}
+
+// The worker's latest result, if it is for the current directory
+static void render_git(char *out, size_t size) {
+    out[0] = '\0';
+    pthread_mutex_lock(&git_lock);
+    if (git_result && *git_result && strcmp(git_result_dir, current_dir) == 0) {
+        snprintf(out, size, PROMPT_CYAN "(%s)" PROMPT_RESET, git_result);
+    }
+    pthread_mutex_unlock(&git_lock);
+}
+
+// Git segment, off the prompt path
+
+// Find the git directory of the repository 'dir' is in; in a worktree .git
+// is a file naming it. Returns -1 outside a repository.
+static int find_git_dir(const char *dir, char *git_dir, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (;;) {
+        struct stat st;
+        size_t length = strlen(path);
+        // A path too long for .git to fit can't be looked in
+        int written = snprintf(git_dir, size, "%s/.git", length > 1 ? path : "");
+        if (written >= 0 && (size_t)written < size && stat(git_dir, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) return 0;
+
+            char line[PATH_MAX];
+            FILE *file = fopen(git_dir, "r");
+            int found = file && fgets(line, sizeof(line), file) &&
+                        strncmp(line, "gitdir: ", 8) == 0;
+            if (file) fclose(file);
+            if (!found) return -1;
+            line[strcspn(line, "\n")] = '\0';
+            if (line[8] == '/') {
+                snprintf(git_dir, size, "%s", line + 8);
+            } else {
+                snprintf(git_dir, size, "%s/%s", path, line + 8);
+            }
+            return 0;
+        }
+
+        char *slash = strrchr(path, '/');
+        if (!slash || length <= 1) return -1;
+        if (slash == path) {
+            path[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+}
+
+// Branch name from HEAD, or the abbreviated commit when it is detached
+static int read_git_head(const char *git_dir, char *out, size_t size) {
+    char path[PATH_MAX + 8];
+    char line[256];
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+    int found = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    if (!found) return -1;
+
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "ref: refs/heads/", 16) == 0) {
+        snprintf(out, size, "%s", line + 16);
+    } else if (strncmp(line, "ref: ", 5) == 0) {
+        snprintf(out, size, "%s", line + 5);
+    } else {
+        snprintf(out, size, "%.7s", line);
+    }
+    return 0;
+}
+
+// Whether tracked files have changes, by asking git. Optional locks are off
+// so this never contends with the user's own git commands; a missing git
+// counts as clean.
+static int git_dirty(const char *dir) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) return 0;
+
+    char *args[] = {
+        "git", "-C", (char *)dir, "--no-optional-locks", "status", "--porcelain",
+        "--untracked-files=no", NULL
+    };
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+    // Its own process group, away from Ctrl+C at the prompt
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    pid_t pid;
+    pthread_mutex_lock(&git_lock);
+    int err = git_stop ? ECANCELED : posix_spawnp(&pid, "git", &actions, &attr, args, environ);
+    if (err == 0) git_pid = pid;
+    pthread_mutex_unlock(&git_lock);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        return 0;
+    }
+
+    char buf[GIT_DIRTY_LIMIT];
+    ssize_t n;
+    size_t total = 0;
+    while (total < sizeof(buf) && ((n = read(fds[0], buf, sizeof(buf) - total)) > 0 ||
+                                   (n == -1 && errno == EINTR))) {
+        if (n > 0) total += n;
+    }
+    close(fds[0]);
+    if (total > 0) kill(pid, SIGTERM);  // The answer is known
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+    pthread_mutex_lock(&git_lock);
+    git_pid = 0;
+    pthread_mutex_unlock(&git_lock);
+    return total > 0;
+}
+
+// Segment text for 'dir': "branch", "branch*" with uncommitted changes,
+// or "" outside a repository
+static char *git_segment(const char *dir) {
+    char git_dir[PATH_MAX];
+    char head[256];
+    if (find_git_dir(dir, git_dir, sizeof(git_dir)) == -1 ||
+        read_git_head(git_dir, head, sizeof(head)) == -1) {
+        return strdup("");
+    }
+    char *text = malloc(strlen(head) + 2);
+    if (text) sprintf(text, "%s%s", head, git_dirty(dir) ? "*" : "");
+    return text;
+}
+
+static void *git_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&git_lock);
+    while (!git_stop) {
+        if (!git_request) {
+            pthread_cond_wait(&git_cond, &git_lock);
+            continue;
+        }
+
+        char *dir = git_request;
+        unsigned int gen = git_request_gen;
+        git_request = NULL;
+        pthread_mutex_unlock(&git_lock);
+
+        char *text = git_segment(dir);
+
+        pthread_mutex_lock(&git_lock);
+        if (gen == git_request_gen && text) {
+            // Redraw only if the prompt would look different
+            int shown = git_result && strcmp(git_result_dir, dir) == 0;
+            if (strcmp(shown ? git_result : "", text) != 0) git_redraw = 1;
+            free(git_result_dir);
+            free(git_result);
+            git_result_dir = dir;
+            git_result = text;
+        } else {
+            free(dir);  // Stale
+            free(text);
+        }
+    }
+    pthread_mutex_unlock(&git_lock);
+    return NULL;
+}
+
+// Ask for the git segment of the current directory; supersedes older requests
+static void request_git_segment() {
+    pthread_mutex_lock(&git_lock);
+    if (!git_running && pthread_create(&git_thread, NULL, git_worker, NULL) == 0) {
+        git_running = 1;
+    }
+    git_request_gen++;
+    free(git_request);
+    git_request = strdup(current_dir);
+    pthread_cond_signal(&git_cond);
+    pthread_mutex_unlock(&git_lock);
+}
+
+// Prompt API
+
+void prompt_invalidate(int events) {
+    pending_events |= events;
+}
+
+void prompt_command_done(int status, double duration_ms) {
+    last_status = status;
+    last_duration_ms = duration_ms;
+    pending_events |= PROMPT_COMMAND;
+}
+
+// Whether an asynchronous segment changed since the prompt was built
+int prompt_needs_redraw() {
+    if (!git_running) return 0;
+    pthread_mutex_lock(&git_lock);
+    int redraw = git_redraw;
+    git_redraw = 0;
+    pthread_mutex_unlock(&git_lock);
+    if (redraw) pending_events |= PROMPT_GIT;
+    return redraw;
+}
+
+char *get_prompt() {
+    if (order_count == -1) parse_segments();
+
+    if (pending_events & PROMPT_CWD) {
+        if (!getcwd(current_dir, sizeof(current_dir))) {
+            const char *pwd = getenv("PWD");
+            snprintf(current_dir, sizeof(current_dir), "%s", pwd ? pwd : "?");
+        }
+    }
+    if (git_enabled && (pending_events & (PROMPT_CWD | PROMPT_COMMAND))) {
+        request_git_segment();
+    }
+
+    size_t size = sizeof(PROMPT_RESET "$ ");
+    for (int i = 0; i < order_count; i++) {
+        const Segment *segment = &segments[order[i]];
+        char *text = segment_text[order[i]];
+        if (segment->events & pending_events) segment->render(text, SEGMENT_SIZE);
+        size += strlen(text) + 1;
+    }
+    pending_events = 0;
+
+    char *grown = realloc(prompt, size);
+    if (!grown) return "$ ";
+    prompt = grown;
+
+    size_t length = 0;
+    for (int i = 0; i < order_count; i++) {
+        const char *text = segment_text[order[i]];
+        if (!*text) continue;
+        length += sprintf(prompt + length, "%s%s", length > 0 ? " " : "", text);
+    }
+    strcpy(prompt + length, PROMPT_RESET "$ ");
+    return prompt;
+}
+
+void free_prompt() {
+    if (git_running) {
+        // Don't wait for git in a big repository
+        pthread_mutex_lock(&git_lock);
+        git_stop = 1;
+        if (git_pid > 0) kill(git_pid, SIGTERM);
+        pthread_cond_signal(&git_cond);
+        pthread_mutex_unlock(&git_lock);
+        pthread_join(git_thread, NULL);
+        git_running = 0;
+    }
+    free(git_request);
+    free(git_result_dir);
+    free(git_result);
+    free(prompt);
+    git_request = git_result_dir = git_result = prompt = NULL;
+}
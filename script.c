@@ -0,0 +1,146 @@
+#include "shell.h"
+
+#define SCRIPT_BUFFER_SIZE 65536
+
+// Non-interactive mode: 'myshell -c commands', 'myshell script' or
+// commands piped into stdin. There is no prompt, no history, no suggestion
+// model and no natural-language rewriting; each line is parsed and run
+// straight from a large read buffer.
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t size;
+    size_t start;       // First unconsumed byte
+    size_t end;         // End of buffered data
+    int eof;
+    int rewind;         // Give unread input back to the fd before each line
+} ScriptReader;
+
+// Next line of the script, NUL-terminated in place in the buffer, or NULL
+// at end of input
+static char *next_line(ScriptReader *r) {
+    for (;;) {
+        char *line = r->buf + r->start;
+        char *newline = memchr(line, '\n', r->end - r->start);
+        if (newline) {
+            *newline = '\0';
+            r->start = newline + 1 - r->buf;
+            return line;
+        }
+        if (r->eof) {
+            if (r->start == r->end) return NULL;
+            r->buf[r->end] = '\0';  // Last line without a newline
+            r->start = r->end;
+            return line;
+        }
+
+        // Move the partial line to the front and read more, growing the
+        // buffer for lines longer than it
+        memmove(r->buf, line, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+        if (r->end + 1 >= r->size) {
+            char *buf = realloc(r->buf, r->size * 2);
+            if (!buf) {
+                perror("realloc");
+                return NULL;
+            }
+            r->buf = buf;
+            r->size *= 2;
+        }
+
+        ssize_t n = read(r->fd, r->buf + r->end, r->size - r->end - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) perror("read");
+        if (n <= 0) {
+            r->eof = 1;
+        } else {
+            r->end += n;
+        }
+    }
+}
+
+// When the script is the shell's own stdin, commands it runs read from the
+// same file. If it is seekable, hand the read-ahead back so they start
+// right after the current line.
+static void give_back_input(ScriptReader *r) {
+    if (!r->rewind || r->start == r->end) return;
+    if (lseek(r->fd, -(off_t)(r->end - r->start), SEEK_CUR) != -1) {
+        r->start = r->end = 0;
+        r->eof = 0;
+    }
+}
+
+// Run one line. Returns -1 on a syntax error, which ends the script.
+static int run_line(char *text) {
+    CommandLine *line;
+    if (parse_line(text, &line) == -1) return -1;
+    if (line) {
+        execute_line(line);
+        free_command_line(line);
+    }
+    return 0;
+}
+
+static int run_script_fd(int fd) {
+    ScriptReader reader = { fd, malloc(SCRIPT_BUFFER_SIZE), SCRIPT_BUFFER_SIZE, 0, 0, 0, 0 };
+    if (!reader.buf) {
+        perror("malloc");
+        return 1;
+    }
+    reader.rewind = fd == STDIN_FILENO && lseek(fd, 0, SEEK_CUR) != -1;
+
+    char *text;
+    while (!exit_requested && (text = next_line(&reader)) != NULL) {
+        give_back_input(&reader);
+        if (run_line(text) == -1) break;
+        reap_jobs();
+    }
+    free(reader.buf);
+    return last_exit_status;
+}
+
+static int run_script_string(const char *commands) {
+    // Each line of the string is run in turn, like a script
+    char *copy = strdup(commands);
+    if (!copy) {
+        perror("strdup");
+        return 1;
+    }
+    char *save;
+    for (char *text = strtok_r(copy, "\n", &save); text && !exit_requested;
+         text = strtok_r(NULL, "\n", &save)) {
+        if (run_line(text) == -1) break;
+    }
+    free(copy);
+    return last_exit_status;
+}
+
+int run_script_mode(int argc, char *argv[]) {
+    init_shell(0);
+
+    int status;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "myshell: -c: option requires an argument\n");
+            shutdown_shell();
+            return 2;
+        }
+        status = run_script_string(argv[2]);
+    } else if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "myshell: %s: %s\n", argv[1], strerror(errno));
+            shutdown_shell();
+            return 127;
+        }
+        status = run_script_fd(fd);
+        close(fd);
+    } else {
+        status = run_script_fd(STDIN_FILENO);
+    }
+
+    shutdown_shell();
+    return status;
+}
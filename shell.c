@@ -1,12 +1,144 @@
+#define _GNU_SOURCE  // posix_spawn_file_actions_addtcsetpgrp_np
 #include "shell.h"
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <pwd.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <poll.h>
 
 #define MAX_HISTORY_SIZE 1000
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
 #define HISTORY_FILE ".myshell_history"
+#define HISTORY_COMPACT_INTERVAL 100  // Appends between journal compactions
+
+// History journal: every command is appended to the history file with a
+// single O_APPEND write, so concurrent shells interleave their lines instead
+// of overwriting each other. The file is compacted back to MAX_HISTORY_SIZE
+// lines every HISTORY_COMPACT_INTERVAL appends and on exit.
+static int history_fd = -1;
+static int appends_since_compact = 0;
+static int appends_since_sync = 0;
+static int history_sync_interval = -1;  // fsync every N appends, 0 = never
+
+// How far into the history file this shell has read or written: the
+// file's inode and the offset just past its last line we know of
+static uint64_t journal_inode = 0;
+static uint64_t journal_offset = 0;
+
+ShellOptions shell_options = {
+    .launch_mode = LAUNCH_SPAWN,
+};
+
+int last_exit_status = 0;
+static int shell_interactive = 0;
+int exit_requested = 0;
+
+// $PIPESTATUS: exit statuses of the last foreground pipeline's stages
+static char *pipe_status_text = NULL;
+
+extern char **environ;
+
+// Startup profile: with --startup-profile each phase's duration is recorded
+// and printed on exit, including the work deferred past the first prompt
+#define MAX_PROFILE_PHASES 16
+
+int startup_profile = 0;
+static struct {
+    const char *phase;
+    double ms;
+} profile_phases[MAX_PROFILE_PHASES];
+static int profile_count = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double profile_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void profile_record(const char *phase, double start) {
+    if (!startup_profile) return;
+    double ms = profile_clock() - start;
+    pthread_mutex_lock(&profile_lock);
+    if (profile_count < MAX_PROFILE_PHASES) {
+        profile_phases[profile_count].phase = phase;
+        profile_phases[profile_count].ms = ms;
+        profile_count++;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void print_startup_profile() {
+    if (!startup_profile) return;
+    pthread_mutex_lock(&profile_lock);
+    fprintf(stderr, "Startup profile (ms):\n");
+    for (int i = 0; i < profile_count; i++) {
+        fprintf(stderr, "  %-28s %8.3f\n", profile_phases[i].phase, profile_phases[i].ms);
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static const char *launch_mode_names[] = { "fork", "spawn" };
+
+int set_launch_mode(const char *name) {
+    for (int i = 0; i < (int)(sizeof(launch_mode_names) / sizeof(launch_mode_names[0])); i++) {
+        if (strcmp(launch_mode_names[i], name) == 0) {
+            shell_options.launch_mode = (LaunchMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Set the capacity of pipeline pipes: bytes with an optional K or M suffix,
+// or 0 / "default". The kernel rounds it up to a power of two pages, so a
+// pipe is tried here and its actual size kept. Returns -1 with errno set.
+int set_pipe_size(const char *value) {
+    if (strcmp(value, "default") == 0) {
+        shell_options.pipe_size = 0;
+        return 0;
+    }
+    
+    char *end;
+    long size = strtol(value, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        size <<= 20;
+        end++;
+    }
+    if (end == value || *end || size < 0 || size > INT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size == 0) {
+        shell_options.pipe_size = 0;
+        return 0;
+    }
+    
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+    int actual = fcntl(fds[1], F_SETPIPE_SZ, (int)size);
+    int saved_errno = errno;
+    close(fds[0]);
+    close(fds[1]);
+    if (actual == -1) {
+        errno = saved_errno;
+        return -1;
+    }
+    shell_options.pipe_size = actual;
+    return 0;
+}
+
+const char *launch_mode_name(LaunchMode mode) {
+    return launch_mode_names[mode];
+}
 
 static char *get_history_path() {
     static char path[1024];
@@ -19,242 +151,1181 @@ static char *get_history_path() {
     return path;
 }
 
-void init_shell() {
+// Whether the open journal is still the file at the history path; it isn't
+// after another shell compacted (replaced) it
+static int history_journal_current() {
+    struct stat path_st, fd_st;
+    return stat(get_history_path(), &path_st) == 0 && fstat(history_fd, &fd_st) == 0 &&
+           path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev;
+}
+
+static int open_history_journal() {
+    if (history_fd != -1) {
+        if (history_journal_current()) return history_fd;
+        close(history_fd);
+    }
+    
+    history_fd = open(get_history_path(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    return history_fd;
+}
+
+// Rewrite the history file with only its last MAX_HISTORY_SIZE lines.
+// Holds an exclusive lock so appends from other shells aren't lost.
+static void compact_history_file() {
+    const char *histfile = get_history_path();
+    int fd = open(histfile, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    
+    if (flock(fd, LOCK_EX) == -1) {
+        close(fd);
+        return;
+    }
+    
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = malloc(st.st_size);
+    }
+    
+    ssize_t size = 0;
+    while (data && size < st.st_size) {
+        ssize_t n = read(fd, data + size, st.st_size - size);
+        if (n <= 0) break;
+        size += n;
+    }
+    
+    // Find the start of the last MAX_HISTORY_SIZE lines
+    ssize_t start = size;
+    int lines = 0;
+    if (start > 0 && data[start - 1] == '\n') start--;
+    while (start > 0) {
+        if (data[start - 1] == '\n' && ++lines == MAX_HISTORY_SIZE) break;
+        start--;
+    }
+    
+    if (data && start > 0) {
+        char tmp_path[1100];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d", histfile, (int)getpid());
+        int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (tmp_fd != -1) {
+            ssize_t written = write(tmp_fd, data + start, size - start);
+            struct stat tmp_st;
+            int ok = written == size - start && fsync(tmp_fd) == 0 && fstat(tmp_fd, &tmp_st) == 0;
+            // Closed whatever happened above; a failed close fails the write
+            if (close(tmp_fd) != 0) ok = 0;
+            if (ok && rename(tmp_path, histfile) == 0) {
+                // Our position moves to the same line in the new file
+                if (journal_inode == (uint64_t)st.st_ino) {
+                    journal_inode = tmp_st.st_ino;
+                    journal_offset = journal_offset > (uint64_t)start ? journal_offset - start : 0;
+                }
+            } else {
+                unlink(tmp_path);
+            }
+        }
+    }
+    
+    free(data);
+    close(fd);  // Releases the lock
+    appends_since_compact = 0;
+}
+
+void append_command_history(const char *line) {
+    if (history_sync_interval < 0) {
+        const char *sync = getenv("MYSHELL_HISTORY_SYNC");
+        history_sync_interval = sync ? atoi(sync) : 0;
+    }
+    
+    size_t len = strlen(line);
+    char *record = malloc(len + 1);
+    if (!record) return;
+    memcpy(record, line, len);
+    record[len] = '\n';
+    
+    // A shared lock keeps the append out of a concurrent compaction; if the
+    // file was replaced while we waited, retry on the new one
+    int fd = -1;
+    for (int tries = 0; tries < 3; tries++) {
+        fd = open_history_journal();
+        if (fd == -1 || flock(fd, LOCK_SH) == -1 || history_journal_current()) break;
+    }
+    
+    if (fd == -1 || write(fd, record, len + 1) != (ssize_t)(len + 1)) {
+        fprintf(stderr, "Warning: Could not append history to %s: %s\n",
+                get_history_path(), strerror(errno));
+    } else {
+        // With O_APPEND the file offset is the end of the line just written
+        struct stat st;
+        off_t end = lseek(fd, 0, SEEK_CUR);
+        if (end != -1 && fstat(fd, &st) == 0) {
+            journal_inode = st.st_ino;
+            journal_offset = end;
+        }
+        if (history_sync_interval > 0 && ++appends_since_sync >= history_sync_interval) {
+            fdatasync(fd);
+            appends_since_sync = 0;
+        }
+    }
+    if (fd != -1) flock(fd, LOCK_UN);
+    free(record);
+    
+    if (++appends_since_compact >= HISTORY_COMPACT_INTERVAL) {
+        compact_history_file();
+    }
+}
+
+void init_shell(int interactive) {
     // Set up any necessary initialization
+    double start = profile_clock();
+    shell_interactive = interactive;
     setenv("SHELL", getcwd(NULL, 0), 1);
     
-    // Set history file
-    const char *histfile = get_history_path();
+    // MYSHELL_LAUNCH=fork|spawn picks the initial launch engine
+    const char *launch = getenv("MYSHELL_LAUNCH");
+    if (launch && set_launch_mode(launch) == -1) {
+        fprintf(stderr, "Warning: unknown launch mode '%s'\n", launch);
+    }
+    profile_record("environment", start);
     
-    // Read history if file exists
-    if (access(histfile, F_OK) == 0) {
-        if (read_history(histfile) != 0) {
+    // Process groups and terminal hand-off for jobs
+    start = profile_clock();
+    init_job_control(interactive);
+    profile_record("job control", start);
+    init_frecency(interactive);
+    
+    // History and the suggestion model are loaded on first use, after the
+    // first prompt is up; see load_command_history
+}
+
+void free_history_lines(HistoryLines *history) {
+    if (!history) return;
+    free(history->lines);
+    free(history->data);
+    free(history);
+}
+
+// Read the history file with one read and split it into lines in place
+static HistoryLines *read_history_lines(const char *histfile) {
+    int fd = open(histfile, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
             fprintf(stderr, "Warning: Could not read history from %s\n", histfile);
-        } else {
-            // Truncate history if needed
-            int history_size = history_length;
-            if (history_size > MAX_HISTORY_SIZE) {
-                history_truncate_file(histfile, MAX_HISTORY_SIZE);
-                clear_history();
-                read_history(histfile);
-            }
         }
+        return NULL;
     }
     
-    // Set maximum history size
-    stifle_history(MAX_HISTORY_SIZE);
+    struct stat st;
+    HistoryLines *history = calloc(1, sizeof(HistoryLines));
+    if (!history || fstat(fd, &st) == -1 || !(history->data = malloc(st.st_size + 1))) {
+        free(history);
+        close(fd);
+        return NULL;
+    }
     
-    // Initialize AI suggestion system
-    init_ai_suggest();
+    ssize_t size = 0;
+    while (size < st.st_size) {
+        ssize_t n = read(fd, history->data + size, st.st_size - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += n;
+    }
+    close(fd);
+    history->data[size] = '\0';
+    history->inode = st.st_ino;
+    
+    int capacity = 0;
+    for (ssize_t i = 0; i < size; i++) {
+        if (history->data[i] == '\n') capacity++;
+    }
+    history->lines = malloc((capacity + 1) * sizeof(char *));
+    if (!history->lines) {
+        free_history_lines(history);
+        return NULL;
+    }
     
-    // Analyze command history for patterns
-    analyze_command_history();
+    char *line = history->data;
+    while (line < history->data + size) {
+        char *newline = strchr(line, '\n');
+        if (newline) *newline = '\0';
+        if (*line) history->lines[history->count++] = line;
+        if (!newline) break;
+        line = newline + 1;
+    }
+    return history;
 }
 
-void save_command_history() {
-    const char *histfile = get_history_path();
-    if (write_history(histfile) != 0) {
-        fprintf(stderr, "Warning: Could not save history to %s: %s\n", 
-                histfile, strerror(errno));
+// Load the history file the first time it is needed: the prompt is shown
+// before it is read, and the event hook or the first command calls this.
+// The lines go into readline's history and then to the suggestion model,
+// which trains from the same parse in the background.
+void load_command_history() {
+    static int loaded = 0;
+    if (loaded || !shell_interactive) return;
+    loaded = 1;
+    
+    double start = profile_clock();
+    stifle_history(MAX_HISTORY_SIZE);
+    HistoryLines *history = read_history_lines(get_history_path());
+    if (history) {
+        // We have read up to the end of its last line
+        journal_inode = history->inode;
+        if (history->count > 0) {
+            const char *last = history->lines[history->count - 1];
+            journal_offset = last - history->data + strlen(last) + 1;
+        }
+        // Compaction only rewrites the file; the lines we have are enough
+        if (history->count > MAX_HISTORY_SIZE) compact_history_file();
+        int first = history->count > MAX_HISTORY_SIZE ? history->count - MAX_HISTORY_SIZE : 0;
+        for (int i = first; i < history->count; i++) {
+            add_history(history->lines[i]);
+        }
+        using_history();  // A prompt may already be up; browse from the end
     }
+    profile_record("history load (deferred)", start);
     
-    // Free AI suggestion resources
-    free_ai_suggest();
+    init_ai_suggest(history);
+}
+
+// Where this shell is in the history file, for resuming from it later;
+// -1 if it hasn't read or written the file
+int get_history_position(uint64_t *inode, uint64_t *offset) {
+    if (journal_inode == 0) return -1;
+    *inode = journal_inode;
+    *offset = journal_offset;
+    return 0;
 }
 
-char *get_prompt() {
-    static char prompt[MAX_LINE * 2];  // Double the size to handle long paths
-    char cwd[MAX_LINE];
+void save_command_history() {
+    // Every command is already in the journal; flush and compact it
+    if (history_fd != -1) {
+        if (appends_since_sync > 0) fdatasync(history_fd);
+        close(history_fd);
+        history_fd = -1;
+    }
+    compact_history_file();
+}
+
+// Persist everything and release long-lived state before exiting
+void shutdown_shell() {
+    if (shell_interactive) {
+        save_command_history();
+        checkpoint_ai_suggest(1);
+        free_ai_suggest();
+        free_natural_commands();
+        free_prompt();
+        free_completion_cache();
+        save_frecency_index(1);
+        free_frecency();
+    }
+    free_path_cache();
+    free_jobs();
+    free(pipe_status_text);
+    pipe_status_text = NULL;
+    print_startup_profile();
+}
+
+// Tell the user a command doesn't exist, with likely intended commands
+static void report_command_not_found(const char *name) {
+    fprintf(stderr, "%s: command not found\n", name);
     
-    // Get current working directory
-    if (getcwd(cwd, sizeof(cwd)) == NULL) {
-        strcpy(cwd, "unknown");
+    int count = 0;
+    char **corrections = suggest_command_corrections(name, &count);
+    if (count > 0) {
+        fprintf(stderr, "Did you mean: ");
+        for (int i = 0; i < count; i++) {
+            fprintf(stderr, "%s%s", i > 0 ? ", " : "", corrections[i]);
+            free(corrections[i]);
+        }
+        fprintf(stderr, "?\n");
+    }
+    free(corrections);
+}
+
+// Built-in commands. 'pure' builtins only write output and don't change
+// shell state, so they can run inside the shell even in the middle of a
+// pipeline.
+typedef struct {
+    const char *name;
+    int (*run)(Command *cmd);   // Returns the exit status
+    int pure;
+} Builtin;
+
+static const Builtin builtins[] = {
+    {"cd",       builtin_cd,       0},
+    {"pwd",      builtin_pwd,      1},
+    {"echo",     builtin_echo,     1},
+    {"pinfo",    builtin_pinfo,    1},
+    {"setenv",   builtin_setenv,   0},
+    {"unsetenv", builtin_unsetenv, 0},
+    {"help",     builtin_help,     1},
+    {"hash",     builtin_hash,     0},
+    {"rehash",   builtin_rehash,   0},
+    {"shopt",    builtin_shopt,    0},
+    {"exit",     builtin_exit,     0},
+    {"jobs",     builtin_jobs,     0},
+    {"fg",       builtin_fg,       0},
+    {"bg",       builtin_bg,       0},
+    {"wait",     builtin_wait,     0},
+    {"z",        builtin_z,        0},
+    {"j",        builtin_z,        0},
+    {NULL, NULL, 0}
+};
+
+static const Builtin *find_builtin(const char *name) {
+    for (int i = 0; builtins[i].name; i++) {
+        if (strcmp(builtins[i].name, name) == 0) return &builtins[i];
+    }
+    return NULL;
+}
+
+// A command's standard streams: fds[0..2] become its stdin, stdout and
+// stderr. Pipes and redirections replace the shell's own descriptors.
+#define STD_FDS_INIT { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO }
+
+// Point the shell's standard streams at fds[], keeping copies of the
+// originals in saved[] so restore_std_fds() can put them back
+static void redirect_std_fds(const int fds[3], int saved[3]) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        saved[i] = -1;
+        if (fds[i] != i) {
+            saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+            dup2(fds[i], i);
+        }
     }
+}
+
+static void restore_std_fds(int saved[3]) {
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);  // A closed pipe mustn't poison later output
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] != -1) {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+    }
+}
+
+// Run a builtin inside the shell with fds[] as its standard streams
+static int run_builtin(const Builtin *builtin, Command *cmd, const int fds[3]) {
+    int saved[3];
+    redirect_std_fds(fds, saved);
     
-    // Format prompt with color and path
-    snprintf(prompt, sizeof(prompt), "\001\033[1;32m\002%s\001\033[0m\002$ ", cwd);
+    // Writing to a pipe whose reader has exited must fail with EPIPE
+    // rather than kill the shell
+    void (*old_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    int status = builtin->run(cmd);
+    fflush(stdout);
+    signal(SIGPIPE, old_sigpipe);
     
-    // Ensure null termination
-    prompt[sizeof(prompt) - 1] = '\0';
-    return prompt;
+    restore_std_fds(saved);
+    return status;
+}
+
+static double timeval_ms(struct timeval tv) {
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
 }
 
-char *read_line() {
-    char *line = NULL;
-    size_t bufsize = 0;
-    ssize_t nread = getline(&line, &bufsize, stdin);
+static void timeval_diff(struct timeval *result, struct timeval end, struct timeval start) {
+    result->tv_sec = end.tv_sec - start.tv_sec;
+    result->tv_usec = end.tv_usec - start.tv_usec;
+    if (result->tv_usec < 0) {
+        result->tv_sec--;
+        result->tv_usec += 1000000;
+    }
+}
+
+// Work done by the shell itself for a stage, reported like a child's
+// wait4() usage. Only this thread is counted, not the suggestion worker.
+typedef struct {
+    struct rusage usage;
+    struct timespec start;
+} UsageMark;
+
+static void usage_mark(UsageMark *mark) {
+    getrusage(RUSAGE_THREAD, &mark->usage);
+    clock_gettime(CLOCK_MONOTONIC, &mark->start);
+}
+
+static void usage_since(const UsageMark *mark, StageUsage *report) {
+    struct rusage after;
+    report->real_ms = elapsed_ms(&mark->start);
+    getrusage(RUSAGE_THREAD, &after);
+    memset(&report->usage, 0, sizeof(report->usage));
+    timeval_diff(&report->usage.ru_utime, after.ru_utime, mark->usage.ru_utime);
+    timeval_diff(&report->usage.ru_stime, after.ru_stime, mark->usage.ru_stime);
+    report->usage.ru_maxrss = after.ru_maxrss;
+    report->usage.ru_nvcsw = after.ru_nvcsw - mark->usage.ru_nvcsw;
+    report->usage.ru_nivcsw = after.ru_nivcsw - mark->usage.ru_nivcsw;
+}
+
+static int run_builtin_measured(const Builtin *builtin, Command *cmd, const int fds[3],
+                                StageUsage *report) {
+    UsageMark mark;
+    usage_mark(&mark);
+    report->status = run_builtin(builtin, cmd, fds);
+    usage_since(&mark, report);
+    return report->status;
+}
+
+// Open the command's redirection files, replacing the matching fds[].
+// Returns -1 (after reporting the error) if a file can't be opened.
+static int open_redirections(Command *cmd, int fds[3]) {
+    if (cmd->input_file) {
+        int fd = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(cmd->input_file);
+            return -1;
+        }
+        fds[0] = fd;
+    }
     
-    if (nread == -1) {
-        if (feof(stdin)) {
-            printf("\n");
-            exit(0);
+    const char *files[3] = { NULL, cmd->output_file, cmd->error_file };
+    for (int i = 1; i < 3; i++) {
+        if (!files[i]) continue;
+        
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        flags |= i == 1 && cmd->append_output ? O_APPEND : O_TRUNC;
+        int fd = open(files[i], flags, 0644);
+        if (fd == -1) {
+            perror(files[i]);
+            if (cmd->input_file) close(fds[0]);
+            if (i == 2 && cmd->output_file) close(fds[1]);
+            return -1;
         }
-        perror("getline");
-        return NULL;
+        fds[i] = fd;
+    }
+    return 0;
+}
+
+static void close_redirections(Command *cmd, const int fds[3]) {
+    if (cmd->input_file) close(fds[0]);
+    if (cmd->output_file) close(fds[1]);
+    if (cmd->error_file) close(fds[2]);
+}
+
+// Launch engines
+//
+// Both engines start 'cmd' with fds[] as its standard streams and close
+// the 'close_fds' (other pipe ends) in the child. 'path' is the resolved
+// executable, or NULL to search $PATH. The child joins process group
+// 'pgid' (0: a new group of its own, -1: the shell's) and, if 'terminal'
+// is set, becomes the terminal's foreground group.
+//
+// LAUNCH_FORK duplicates the shell with fork(), whose cost grows with the
+// shell's address space (readline history, suggestion model, ...).
+// LAUNCH_SPAWN uses posix_spawn, which glibc implements with
+// clone(CLONE_VM | CLONE_VFORK): the child borrows the parent's memory until
+// it execs, so no page tables are copied.
+
+typedef struct {
+    const int *fds;          // stdin, stdout, stderr
+    const int *close_fds;    // Other pipe ends to close in the child
+    int close_count;
+    pid_t pgid;
+    int terminal;
+} LaunchSetup;
+
+static pid_t fork_external(Command *cmd, const char *path, const LaunchSetup *setup) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    
+    if (pid == 0) {  // Child process
+        job_child_setup(setup->pgid, setup->terminal);
+        for (int i = 0; i < 3; i++) {
+            if (setup->fds[i] != i) dup2(setup->fds[i], i);
+        }
+        for (int i = 0; i < setup->close_count; i++) {
+            close(setup->close_fds[i]);
+        }
+        
+        if (path) {
+            execv(path, cmd->args);
+        }
+        // Not cached, or the cached file is gone or not a binary
+        execvp(cmd->command, cmd->args);
+        if (errno == ENOENT) {
+            report_command_not_found(cmd->command);
+            exit(127);
+        }
+        perror("execvp");
+        exit(126);
+    }
+    return pid;
+}
+
+static pid_t spawn_external(Command *cmd, const char *path, const LaunchSetup *setup) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+#ifdef HAVE_SPAWN_TCSETPGRP
+    // Take the terminal before exec, so the child can't read it too early.
+    // This comes first: the terminal fd may be one the dup2()s replace.
+    if (setup->terminal) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, job_terminal_fd());
+    }
+#endif
+    for (int i = 0; i < 3; i++) {
+        if (setup->fds[i] != i) posix_spawn_file_actions_adddup2(&actions, setup->fds[i], i);
+    }
+    for (int i = 0; i < setup->close_count; i++) {
+        posix_spawn_file_actions_addclose(&actions, setup->close_fds[i]);
+    }
+    
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    job_spawn_attributes(&attr, setup->pgid);
+    
+    pid_t pid;
+    int err = ENOENT;
+    if (path) {
+        err = posix_spawn(&pid, path, &actions, &attr, cmd->args, environ);
+    }
+    if (err == ENOENT || (err == EACCES && path != cmd->command)) {
+        // Not cached, or the cached file is gone or not executable; like
+        // execvp(), go on down $PATH
+        err = posix_spawnp(&pid, cmd->command, &actions, &attr, cmd->args, environ);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    
+    if (err == ENOEXEC) {
+        // No #! line: execvp() runs the file with /bin/sh but posix_spawn()
+        // doesn't, so start it the way fork mode does
+        return fork_external(cmd, path, setup);
     }
+    if (err == ENOENT) {
+        report_command_not_found(cmd->command);
+    } else if (err != 0) {
+        fprintf(stderr, "%s: %s\n", cmd->command, strerror(err));
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+#ifndef HAVE_SPAWN_TCSETPGRP
+    if (setup->terminal) tcsetpgrp(job_terminal_fd(), setup->pgid ? setup->pgid : pid);
+#endif
+    return pid;
+}
+
+// Returns the child's pid, or -1 with errno set if it couldn't be started
+static pid_t launch_external(Command *cmd, const LaunchSetup *setup) {
+    // Resolve the command through the $PATH cache instead of probing
+    // every directory
+    const char *path = strchr(cmd->command, '/') ? cmd->command : path_cache_lookup(cmd->command);
     
-    // Remove newline
-    if (line[nread - 1] == '\n') {
-        line[nread - 1] = '\0';
+    if (shell_options.launch_mode == LAUNCH_SPAWN) {
+        return spawn_external(cmd, path, setup);
+    }
+    return fork_external(cmd, path, setup);
+}
+
+// Exit status for a command that could not be started
+static int launch_failure_status() {
+    return errno == ENOENT ? 127 : 126;
+}
+
+// Whether a builtin may run inside the shell as a pipeline stage. A
+// watching pinfo only stops on Ctrl+C, which goes to the stages that own
+// the terminal, so it is forked like them.
+static int pure_stage(const Builtin *builtin, const Command *cmd) {
+    return builtin->pure && !(builtin->run == builtin_pinfo && pinfo_watches(cmd));
+}
+
+// Pick the pipeline stage (if any) that runs inside the shell: a pure
+// builtin last stage, or a pure builtin whose downstream stages are all
+// external and so already running to drain its output. The last stage stays
+// in the shell only without job control: otherwise the other stages take
+// the terminal, and Ctrl-C couldn't reach it. Returns -1 if every stage forks.
+static int in_process_stage(Pipeline *pipeline) {
+    int last = pipeline->command_count - 1;
+    const Builtin *last_builtin = find_builtin(pipeline->commands[last].command);
+    if (last_builtin) {
+        return pure_stage(last_builtin, &pipeline->commands[last]) && !job_control_enabled() ? last : -1;
     }
     
-    return line;
+    for (int i = last - 1; i >= 0; i--) {
+        const Builtin *builtin = find_builtin(pipeline->commands[i].command);
+        if (builtin) return pure_stage(builtin, &pipeline->commands[i]) ? i : -1;
+    }
+    return -1;
 }
 
-void execute_pipeline(Pipeline *pipeline) {
-    if (pipeline->command_count == 1) {
-        execute_command(&pipeline->commands[0]);
+static int run_single_builtin(const Builtin *builtin, Command *cmd, StageUsage *report) {
+    int fds[3] = STD_FDS_INIT;
+    if (open_redirections(cmd, fds) == -1) return report->status = 1;
+    int status = run_builtin_measured(builtin, cmd, fds, report);
+    close_redirections(cmd, fds);
+    return status;
+}
+
+// Feeding files into a pipeline
+//
+// A first stage of plain 'cat FILE...' is not started: the shell splice()s
+// the files into the first pipe itself, so the data never passes through a
+// reader process. The pipe end is non-blocking and the shell also watches
+// the SIGCHLD pipe; if the job is stopped meanwhile, a child takes over the
+// rest of the copy and stops along with the job.
+
+#define FEED_CHUNK (1 << 20)
+#define FEED_BUFFER 65536
+
+typedef struct {
+    int out;            // Write end of the first pipe
+    int *fds;           // The files, in order
+    char **names;
+    int count;
+    int current;        // File being copied
+    int copying;        // splice() unsupported for it: read() and write()
+    char *buffer;       // ...through this
+    size_t pending;     // Bytes in buffer
+    size_t offset;      // Of which already written
+    int status;         // 1 if a file could not be read
+} Feed;
+
+// Open the files of a first stage the shell can feed itself: 'cat' with only
+// regular files as arguments, no options and no redirections. Returns 0 if
+// the stage has to run as a process.
+static int open_feed(Pipeline *pipeline, Feed *feed) {
+    Command *cmd = &pipeline->commands[0];
+    if (pipeline->command_count < 2 || strcmp(cmd->command, "cat") != 0 ||
+        cmd->arg_count < 2 || cmd->input_file || cmd->output_file || cmd->error_file) {
+        return 0;
+    }
+    for (int i = 1; i < cmd->arg_count; i++) {
+        if (cmd->args[i][0] == '-') return 0;
+    }
+    
+    memset(feed, 0, sizeof(*feed));
+    feed->out = -1;
+    feed->names = cmd->args + 1;
+    feed->fds = malloc((cmd->arg_count - 1) * sizeof(int));
+    if (!feed->fds) return 0;
+    for (; feed->count < cmd->arg_count - 1; feed->count++) {
+        struct stat st;
+        int fd = open(feed->names[feed->count], O_RDONLY | O_CLOEXEC);
+        if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            feed->fds[feed->count] = fd;
+            continue;
+        }
+        // cat reports the error as usual
+        if (fd != -1) close(fd);
+        while (feed->count > 0) close(feed->fds[--feed->count]);
+        free(feed->fds);
+        return 0;
+    }
+    return 1;
+}
+
+static void close_feed(Feed *feed) {
+    for (int i = feed->current; i < feed->count; i++) {
+        close(feed->fds[i]);
+    }
+    if (feed->out != -1) close(feed->out);
+    free(feed->fds);
+    free(feed->buffer);
+}
+
+static void next_feed_file(Feed *feed) {
+    close(feed->fds[feed->current++]);
+    feed->copying = 0;
+    feed->pending = feed->offset = 0;
+}
+
+// Copy as much as the pipe takes. Returns 1 once every file is copied, 0 if
+// the pipe is full, or -1 if nobody reads it any more.
+static int feed_step(Feed *feed) {
+    while (feed->current < feed->count) {
+        int in = feed->fds[feed->current];
+        ssize_t n;
+        if (feed->offset < feed->pending) {
+            n = write(feed->out, feed->buffer + feed->offset, feed->pending - feed->offset);
+            if (n > 0) feed->offset += n;
+        } else if (!feed->copying) {
+            n = splice(in, NULL, feed->out, NULL, FEED_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n == -1 && errno == EINVAL) {
+                feed->copying = 1;
+                continue;
+            }
+            // Short: the pipe is full (or the file ends), so skip the retry
+            // that would only fail with EAGAIN
+            if (n > 0 && n < FEED_CHUNK) return 0;
+        } else {
+            if (!feed->buffer && !(feed->buffer = malloc(FEED_BUFFER))) return -1;
+            n = read(in, feed->buffer, FEED_BUFFER);
+            if (n > 0) {
+                feed->pending = n;
+                feed->offset = 0;
+            }
+        }
+        
+        if (n > 0) continue;
+        if (n == 0) {
+            next_feed_file(feed);
+        } else if (errno == EAGAIN) {
+            return 0;
+        } else if (errno == EPIPE) {
+            return -1;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "cat: %s: %s\n", feed->names[feed->current], strerror(errno));
+            feed->status = 1;
+            next_feed_file(feed);
+        }
+    }
+    return 1;
+}
+
+// Status cat would have had
+static int feed_status(Feed *feed, int result) {
+    return result == -1 ? 128 + SIGPIPE : feed->status;
+}
+
+// Pump the files into the pipeline, recording the work as its first stage
+static void run_feed(Feed *feed, Job *job, StageUsage *report) {
+    UsageMark mark;
+    usage_mark(&mark);
+    void (*old_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    fcntl(feed->out, F_SETFL, O_NONBLOCK);
+    
+    int result;
+    while ((result = feed_step(feed)) == 0) {
+        struct pollfd pfds[2] = { { feed->out, POLLOUT, 0 }, { job_wakeup_fd(), POLLIN, 0 } };
+        if (poll(pfds, 2, -1) == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (!pfds[1].revents) continue;
+        
+        reap_jobs();
+        if (!job_stopped(job)) continue;
+        
+        // Ctrl-Z: hand the rest to a process that stops with the job
+        pid_t pid = fork();
+        if (pid == 0) {
+            job_child_setup(job_launch_pgid(job), 0);
+            raise(SIGSTOP);
+            fcntl(feed->out, F_SETFL, 0);
+            while ((result = feed_step(feed)) == 0);
+            _exit(feed_status(feed, result));
+        }
+        if (pid == -1) {
+            perror("fork");
+            break;
+        }
+        job_add_process(job, pid, report);
+        signal(SIGPIPE, old_sigpipe);
         return;
     }
+    signal(SIGPIPE, old_sigpipe);
     
-    int pipes[MAX_PIPES][2];
-    pid_t pids[MAX_PIPES];
+    usage_since(&mark, report);
+    report->status = feed_status(feed, result);
+}
+
+// Start and wait for the pipeline's stages, filling in stages[] for each.
+// Returns the pipeline's exit status.
+static int run_pipeline(Pipeline *pipeline, int background, StageUsage *stages) {
+    // A lone builtin runs directly in the shell
+    const Builtin *builtin = find_builtin(pipeline->commands[0].command);
+    if (pipeline->command_count == 1 && builtin && !background) {
+        return run_single_builtin(builtin, &pipeline->commands[0], &stages[0]);
+    }
+    
+    int pipe_count = pipeline->command_count - 1;
+    int (*pipes)[2] = malloc((pipe_count + 1) * sizeof(*pipes));
+    if (!pipes) {
+        perror("malloc");
+        return 1;
+    }
     
-    // Create pipes
-    for (int i = 0; i < pipeline->command_count - 1; i++) {
+    // Create pipes. A size the kernel refuses (over the per-user limit)
+    // leaves the pipe at its default.
+    for (int i = 0; i < pipe_count; i++) {
         if (pipe(pipes[i]) == -1) {
             perror("pipe");
-            return;
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            free(pipes);
+            return 1;
         }
+        if (shell_options.pipe_size) fcntl(pipes[i][1], F_SETPIPE_SZ, shell_options.pipe_size);
     }
     
-    // Execute commands
+    char *text = format_node(&(Node){ .type = NODE_PIPELINE, .pipeline = pipeline });
+    Job *job = job_create(text, !background);
+    free(text);
+    if (!job) {
+        perror("malloc");
+        free(pipes);
+        return 1;
+    }
+    
+    // Start every stage except the one that runs in the shell, or the files
+    // it feeds in. Stages that fail to start get their status here, the
+    // others when they exit.
+    int local = background ? -1 : in_process_stage(pipeline);
+    Feed feed;
+    int feeding = local == -1 && !background && open_feed(pipeline, &feed);
     for (int i = 0; i < pipeline->command_count; i++) {
-        pids[i] = fork();
+        Command *cmd = &pipeline->commands[i];
+        int fds[3] = STD_FDS_INIT;
+        if (i > 0) fds[0] = pipes[i-1][0];
+        if (i < pipe_count) fds[1] = pipes[i][1];
         
-        if (pids[i] == -1) {
-            perror("fork");
-            return;
+        if (i == local || (i == 0 && feeding)) continue;
+        if (open_redirections(cmd, fds) == -1) {
+            stages[i].status = 1;
+            continue;
         }
         
-        if (pids[i] == 0) {  // Child process
-            // Set up input
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            // Set up output
-            if (i < pipeline->command_count - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
+        LaunchSetup setup = {
+            fds, &pipes[0][0], pipe_count * 2,
+            job_launch_pgid(job), job_takes_terminal(job)
+        };
+        pid_t pid;
+        const Builtin *builtin = find_builtin(cmd->command);
+        if (!builtin) {
+            pid = launch_external(cmd, &setup);
+            if (pid == -1) stages[i].status = launch_failure_status();
+        } else if ((pid = fork()) == 0) {
+            // Built-ins that change shell state run in a subshell
+            job_child_setup(setup.pgid, setup.terminal);
+            for (int j = 0; j < 3; j++) {
+                if (fds[j] != j) dup2(fds[j], j);
             }
-            
-            // Close all pipes
-            for (int j = 0; j < pipeline->command_count - 1; j++) {
+            for (int j = 0; j < pipe_count; j++) {
                 close(pipes[j][0]);
                 close(pipes[j][1]);
             }
-            
-            execute_command(&pipeline->commands[i]);
-            exit(0);
+            exit(builtin->run(cmd));
+        } else if (pid == -1) {
+            perror("fork");
+            stages[i].status = 1;
         }
+        if (pid != -1) job_add_process(job, pid, background ? NULL : &stages[i]);
+        
+        close_redirections(cmd, fds);
     }
     
     // Parent process
-    // Close all pipes
-    for (int i = 0; i < pipeline->command_count - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    // Close all pipes, except the ends the in-shell stage uses
+    int local_in = local > 0 ? pipes[local-1][0] : -1;
+    int local_out = local >= 0 && local < pipe_count ? pipes[local][1] : -1;
+    if (feeding) local_out = feed.out = pipes[0][1];
+    for (int i = 0; i < pipe_count; i++) {
+        if (pipes[i][0] != local_in) close(pipes[i][0]);
+        if (pipes[i][1] != local_out) close(pipes[i][1]);
     }
+    free(pipes);
     
-    // Wait for all children
-    for (int i = 0; i < pipeline->command_count; i++) {
-        waitpid(pids[i], NULL, 0);
+    if (local != -1) {
+        Command *cmd = &pipeline->commands[local];
+        int fds[3] = STD_FDS_INIT;
+        if (local_in != -1) fds[0] = local_in;
+        if (local_out != -1) fds[1] = local_out;
+        stages[local].status = 1;
+        if (open_redirections(cmd, fds) == 0) {
+            run_builtin_measured(find_builtin(cmd->command), cmd, fds, &stages[local]);
+            close_redirections(cmd, fds);
+        }
+        if (local_in != -1) close(local_in);
+        if (local_out != -1) close(local_out);
+    }
+    if (feeding) {
+        run_feed(&feed, job, &stages[0]);
+        close_feed(&feed);
+    }
+    
+    if (job_process_count(job) == 0) {
+        job_discard(job);
+        return stages[pipe_count].status;
     }
+    if (background) {
+        job_background(job, 0);
+        return 0;
+    }
+    
+    // Wait for all children; the last stage decides the pipeline's status
+    int status = job_foreground(job, 0);
+    return status == 128 + SIGTSTP ? status : stages[pipe_count].status;
 }
 
-void execute_command(Command *cmd) {
-    // Handle built-in commands
-    if (strcmp(cmd->command, "cd") == 0) {
-        builtin_cd(cmd);
-        return;
-    } else if (strcmp(cmd->command, "pwd") == 0) {
-        builtin_pwd();
-        return;
-    } else if (strcmp(cmd->command, "echo") == 0) {
-        builtin_echo(cmd);
-        return;
-    } else if (strcmp(cmd->command, "pinfo") == 0) {
-        builtin_pinfo(cmd);
-        return;
-    } else if (strcmp(cmd->command, "setenv") == 0) {
-        builtin_setenv(cmd);
-        return;
-    } else if (strcmp(cmd->command, "unsetenv") == 0) {
-        builtin_unsetenv(cmd);
-        return;
-    } else if (strcmp(cmd->command, "help") == 0) {
-        builtin_help(cmd);
-        return;
+// Deferred expansion
+//
+// The parser leaves EXPAND_MARK where a '$' starts an expansion; the words
+// are expanded right before their pipeline runs, into an arena that lives
+// as long as the pipeline. There is no word splitting: an expansion always
+// stays inside the word it is part of.
+
+#define EXPAND_ARENA_BLOCK 1024
+
+static void record_pipe_status(const StageUsage *stages, int count) {
+    char *text = malloc(count * 12 + 2);
+    if (!text) return;
+    size_t length = 0;
+    text[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        length += sprintf(text + length, "%s%d", i > 0 ? " " : "", stages[i].status);
+    }
+    free(pipe_status_text);
+    pipe_status_text = text;
+}
+
+static int is_name_char(char c) {
+    return c == '_' || isalnum((unsigned char)c);
+}
+
+static const char *variable_value(const char *name, size_t length) {
+    if (length == 10 && strncmp(name, "PIPESTATUS", 10) == 0) {
+        return pipe_status_text ? pipe_status_text : "0";
+    }
+    char key[256];
+    if (length >= sizeof(key)) return "";
+    memcpy(key, name, length);
+    key[length] = '\0';
+    const char *value = getenv(key);
+    return value ? value : "";
+}
+
+// Home directory for a tilde prefix: the user's own for an empty name.
+// NULL for an unknown user, which leaves the prefix as it is.
+static const char *tilde_value(const char *name, size_t length) {
+    if (length == 0) {
+        const char *home = getenv("HOME");
+        if (home) return home;
+        struct passwd *pw = getpwuid(getuid());
+        return pw ? pw->pw_dir : NULL;
     }
+    char user[256];
+    if (length >= sizeof(user)) return NULL;
+    memcpy(user, name, length);
+    user[length] = '\0';
+    struct passwd *pw = getpwnam(user);
+    return pw ? pw->pw_dir : NULL;
+}
+
+// 'word' with its expansions done, in the arena; the word itself if it has
+// none or on allocation failure
+static char *expand_word(Arena *arena, char *word) {
+    if (!word || (*word != TILDE_MARK && !strchr(word, EXPAND_MARK))) return word;
     
-    // Handle redirection
-    int stdin_fd = STDIN_FILENO;
-    int stdout_fd = STDOUT_FILENO;
+    size_t capacity = strlen(word) + 64;
+    size_t length = 0;
+    char *out = arena_alloc(arena, capacity);
+    if (!out) return word;
     
-    if (cmd->input_file) {
-        stdin_fd = open(cmd->input_file, O_RDONLY);
-        if (stdin_fd == -1) {
-            perror("open input file");
-            return;
+    for (const char *p = word; *p; ) {
+        char number[24];
+        const char *value = p;
+        size_t value_length = 1;
+        if (*p == TILDE_MARK) {
+            size_t name_length = strcspn(p + 1, "/");
+            value = tilde_value(p + 1, name_length);
+            if (value) {
+                value_length = strlen(value);
+                p += 1 + name_length;
+            } else {
+                value = "~";
+                p++;
+            }
+        } else if (*p != EXPAND_MARK) {
+            p++;
+        } else if (p[1] == '?' || p[1] == '$') {
+            snprintf(number, sizeof(number), "%d", p[1] == '?' ? last_exit_status : (int)getpid());
+            value = number;
+            value_length = strlen(number);
+            p += 2;
+        } else {
+            // $NAME or ${NAME}; an unterminated ${ stays as it is
+            int braced = p[1] == '{';
+            const char *name = p + 1 + braced;
+            const char *end = name;
+            while (is_name_char(*end)) end++;
+            if (braced && (*end != '}' || end == name)) {
+                value = "$";
+                p++;
+            } else {
+                value = variable_value(name, end - name);
+                value_length = strlen(value);
+                p = end + braced;
+            }
+        }
+        
+        if (length + value_length + 1 > capacity) {
+            size_t new_capacity = (length + value_length + 1) * 2;
+            out = arena_realloc(arena, out, capacity, new_capacity);
+            if (!out) return word;
+            capacity = new_capacity;
         }
+        memcpy(out + length, value, value_length);
+        length += value_length;
+    }
+    out[length] = '\0';
+    return out;
+}
+
+// The pipeline with its words expanded: 'copy' filled in from the arena,
+// or the pipeline itself when none of its commands expand anything
+static Pipeline *expand_pipeline(Pipeline *pipeline, Pipeline *copy, Arena *arena) {
+    int needed = 0;
+    for (int i = 0; i < pipeline->command_count; i++) {
+        needed |= pipeline->commands[i].expand;
     }
+    if (!needed) return pipeline;
     
-    if (cmd->output_file) {
-        int flags = O_WRONLY | O_CREAT;
-        flags |= cmd->append_output ? O_APPEND : O_TRUNC;
-        stdout_fd = open(cmd->output_file, flags, 0644);
-        if (stdout_fd == -1) {
-            perror("open output file");
-            if (stdin_fd != STDIN_FILENO) close(stdin_fd);
-            return;
+    *copy = *pipeline;
+    copy->commands = arena_alloc(arena, pipeline->command_count * sizeof(Command));
+    if (!copy->commands) return pipeline;
+    for (int i = 0; i < pipeline->command_count; i++) {
+        Command *cmd = &copy->commands[i];
+        *cmd = pipeline->commands[i];
+        if (!cmd->expand) continue;
+        
+        cmd->args = arena_alloc(arena, (cmd->arg_count + 1) * sizeof(char *));
+        if (!cmd->args) return pipeline;
+        for (int j = 0; j < cmd->arg_count; j++) {
+            cmd->args[j] = expand_word(arena, pipeline->commands[i].args[j]);
         }
+        cmd->args[cmd->arg_count] = NULL;
+        cmd->command = cmd->args[0];
+        cmd->input_file = expand_word(arena, cmd->input_file);
+        cmd->output_file = expand_word(arena, cmd->output_file);
+        cmd->error_file = expand_word(arena, cmd->error_file);
+        cmd->expand = 0;
+    }
+    return copy;
+}
+
+// The 'time' report: one line per stage, then bash-style totals
+static void print_time_report(Pipeline *pipeline, const StageUsage *stages, double real_ms) {
+    double user_ms = 0, sys_ms = 0;
+    if (pipeline->command_count > 0) {
+        fprintf(stderr, "%5s %6s %10s %10s %10s %10s %7s %7s  %s\n", "stage", "status",
+                "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+    }
+    for (int i = 0; i < pipeline->command_count; i++) {
+        const struct rusage *ru = &stages[i].usage;
+        double user = timeval_ms(ru->ru_utime), sys = timeval_ms(ru->ru_stime);
+        user_ms += user;
+        sys_ms += sys;
+        
+        Pipeline stage = { &pipeline->commands[i], 1, 0 };
+        char *text = format_node(&(Node){ .type = NODE_PIPELINE, .pipeline = &stage });
+        char maxrss[24];
+        snprintf(maxrss, sizeof(maxrss), "%ldK", ru->ru_maxrss);
+        fprintf(stderr, "%5d %6d %9.3fs %9.3fs %9.3fs %10s %7ld %7ld  %s\n", i + 1,
+                stages[i].status, stages[i].real_ms / 1000, user / 1000, sys / 1000, maxrss,
+                ru->ru_nvcsw, ru->ru_nivcsw, text);
+        free(text);
+    }
+    
+    const char *names[3] = { "real", "user", "sys" };
+    double totals[3] = { real_ms, user_ms, sys_ms };
+    fprintf(stderr, "\n");
+    for (int i = 0; i < 3; i++) {
+        int minutes = (int)(totals[i] / 60000);
+        fprintf(stderr, "%s\t%dm%.3fs\n", names[i], minutes, (totals[i] - minutes * 60000.0) / 1000);
+    }
+}
+
+// Run a pipeline as a job. A foreground pipeline is waited for and its
+// exit status (that of the last stage) returned; a background one returns 0
+// as soon as it has started.
+int execute_pipeline(Pipeline *pipeline, int background) {
+    Arena arena;
+    Pipeline copy;
+    arena_init(&arena, EXPAND_ARENA_BLOCK);
+    pipeline = expand_pipeline(pipeline, &copy, &arena);
+    
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int count = pipeline->command_count;
+    StageUsage *stages = calloc(count ? count : 1, sizeof(StageUsage));
+    int status = 0;
+    if (!stages) {
+        perror("calloc");
+        status = 1;
+    } else if (count > 0) {
+        status = run_pipeline(pipeline, background, stages);
     }
     
-    // Execute external command
+    if (stages && !background) {
+        if (pipeline->timed) print_time_report(pipeline, stages, elapsed_ms(&start));
+        record_pipe_status(stages, count ? count : 1);
+    } else if (stages) {
+        record_pipe_status(&(StageUsage){ 0 }, 1);
+    }
+    free(stages);
+    arena_free(&arena);
+    return status;
+}
+
+// Run 'node' in the background. Pipelines become jobs directly; anything
+// else runs in a forked subshell that is a job of its own.
+static int execute_background(Node *node) {
+    if (node->type == NODE_PIPELINE) {
+        return execute_pipeline(node->pipeline, 1);
+    }
+    
+    char *text = format_node(node);
+    Job *job = job_create(text, 0);
+    free(text);
+    if (!job) return 1;
+    
+    pid_t pgid = job_launch_pgid(job);
     pid_t pid = fork();
     if (pid == -1) {
         perror("fork");
-        return;
+        job_discard(job);
+        return 1;
     }
-    
-    if (pid == 0) {  // Child process
-        if (stdin_fd != STDIN_FILENO) {
-            dup2(stdin_fd, STDIN_FILENO);
-            close(stdin_fd);
-        }
-        if (stdout_fd != STDOUT_FILENO) {
-            dup2(stdout_fd, STDOUT_FILENO);
-            close(stdout_fd);
-        }
-        
-        execvp(cmd->command, cmd->args);
-        perror("execvp");
-        exit(1);
-    } else {  // Parent process
-        if (stdin_fd != STDIN_FILENO) close(stdin_fd);
-        if (stdout_fd != STDOUT_FILENO) close(stdout_fd);
-        waitpid(pid, NULL, 0);
+    if (pid == 0) {
+        job_child_setup(pgid, 0);
+        reset_jobs_in_subshell();
+        exit(execute_node(node));
     }
+    job_add_process(job, pid, NULL);
+    job_background(job, 0);
+    return 0;
 }
 
-void free_command(Command *cmd) {
-    if (cmd->command) free(cmd->command);
-    if (cmd->args) {
-        for (int i = 0; i < cmd->arg_count; i++) {
-            free(cmd->args[i]);
-        }
-        free(cmd->args);
+// Run a syntax tree node and return its exit status. && and || only run
+// their right side when the left side succeeded / failed.
+int execute_node(Node *node) {
+    switch (node->type) {
+    case NODE_PIPELINE:
+        last_exit_status = execute_pipeline(node->pipeline, 0);
+        break;
+    case NODE_AND:
+        if (execute_node(node->left) == 0 && !exit_requested) execute_node(node->right);
+        break;
+    case NODE_OR:
+        if (execute_node(node->left) != 0 && !exit_requested) execute_node(node->right);
+        break;
+    case NODE_SEQUENCE:
+        execute_node(node->left);
+        if (!exit_requested) execute_node(node->right);
+        break;
+    case NODE_BACKGROUND:
+        last_exit_status = execute_background(node->left);
+        break;
     }
-    if (cmd->input_file) free(cmd->input_file);
-    if (cmd->output_file) free(cmd->output_file);
+    return last_exit_status;
 }
 
-void free_pipeline(Pipeline *pipeline) {
-    if (pipeline->commands) {
-        for (int i = 0; i < pipeline->command_count; i++) {
-            free_command(&pipeline->commands[i]);
-        }
-        free(pipeline->commands);
-    }
-    free(pipeline);
-} 
\ No newline at end of file
+int execute_line(CommandLine *line) {
+    return execute_node(line->root);
+}
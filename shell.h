@@ -7,15 +7,35 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <spawn.h>
 
 #define MAX_LINE 80
-#define MAX_ARGS 10
-#define MAX_PIPES 10
+
+// Stands in for an unquoted or double-quoted '$' in a parsed word; the
+// expansion itself is deferred until the command runs
+#define EXPAND_MARK '\001'
+// Stands in for an unquoted '~' that starts a word (~ or ~user)
+#define TILDE_MARK '\002'
+
+// Arena allocator: bump allocation, everything released at once
+typedef struct ArenaBlock ArenaBlock;
+typedef struct {
+    ArenaBlock *head;    // Current block (older blocks are chained behind it)
+    size_t block_size;   // Default size of new blocks
+} Arena;
+
+void arena_init(Arena *arena, size_t block_size);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_free(Arena *arena);
 
 // Structure to hold command information
 typedef struct {
@@ -25,25 +45,117 @@ typedef struct {
     char *input_file;
     char *output_file;
     int append_output;
+    char *error_file;    // 2> target
+    int expand;          // Some word contains EXPAND_MARK or TILDE_MARK
 } Command;
 
 // Structure to hold pipeline information
 typedef struct {
     Command *commands;
     int command_count;
+    int timed;           // Prefixed with the 'time' keyword
 } Pipeline;
 
+// What one pipeline stage did, for 'time' and $PIPESTATUS
+typedef struct {
+    int status;
+    double real_ms;
+    struct rusage usage;
+} StageUsage;
+
+// Syntax tree of a command line
+typedef enum {
+    NODE_PIPELINE,     // A single pipeline
+    NODE_AND,          // left && right
+    NODE_OR,           // left || right
+    NODE_SEQUENCE,     // left ; right
+    NODE_BACKGROUND    // left &
+} NodeType;
+
+typedef struct Node {
+    NodeType type;
+    struct Node *left;     // Operands of AND / OR / SEQUENCE / BACKGROUND
+    struct Node *right;
+    Pipeline *pipeline;    // NODE_PIPELINE
+} Node;
+
+// A parsed input line. The tree and everything it points to live in the
+// line's arena, so free_command_line releases it in one go.
+typedef struct {
+    Node *root;
+    Arena arena;
+} CommandLine;
+
+// How external commands are started
+typedef enum {
+    LAUNCH_FORK,       // fork() + execv()
+    LAUNCH_SPAWN       // posix_spawn() (default)
+} LaunchMode;
+
+// Runtime options, changed with the 'shopt' builtin
+typedef struct {
+    LaunchMode launch_mode;
+    int pipe_size;     // Capacity of pipeline pipes in bytes, 0 = system default
+} ShellOptions;
+
+extern ShellOptions shell_options;
+extern int last_exit_status;   // Status of the most recent pipeline
+extern int exit_requested;     // Set by the 'exit' builtin
+
 // Function declarations
-void init_shell();
+void init_shell(int interactive);
 char *get_prompt();
 void save_command_history();
-char *natural_to_shell_command(const char* input);
+void shutdown_shell();
+void append_command_history(const char *line);
+void load_command_history();
+char *natural_to_shell_command(const char* input);   // NULL if nothing to rewrite
+void free_natural_commands();
+int parse_line(const char *line, CommandLine **result);
+int execute_line(CommandLine *line);
+int execute_node(Node *node);
+int execute_pipeline(Pipeline *pipeline, int background);
+char *format_node(Node *node);
+int set_launch_mode(const char *name);
+const char *launch_mode_name(LaunchMode mode);
+int set_pipe_size(const char *value);
+
+// Lines of the history file, read once and shared by readline and the model
+typedef struct {
+    char *data;      // File contents, split into lines in place
+    char **lines;    // Oldest first; a line's file offset is lines[i] - data
+    int count;
+    uint64_t inode;  // The file they were read from
+} HistoryLines;
+void free_history_lines(HistoryLines *history);
+int get_history_position(uint64_t *inode, uint64_t *offset);
+
+// Prompt segments, cached until an event they depend on
+#define PROMPT_CWD 1       // The working directory changed
+#define PROMPT_COMMAND 2   // A command line finished
+void prompt_invalidate(int events);
+void prompt_command_done(int status, double duration_ms);
+int prompt_needs_redraw();                      // An async segment changed
+void free_prompt();
+
+// Startup profiling (--startup-profile)
+extern int startup_profile;
+double profile_clock();                         // Monotonic milliseconds
+void profile_record(const char *phase, double start);
+void print_startup_profile();
 
 // AI command suggestion functions - Phase 1: Local Statistical Analysis
-void init_ai_suggest();                          // Initialize the AI suggestion system
-void add_command_sequence(const char *prev, const char *current); // Add command to history
+void init_ai_suggest(HistoryLines *history);     // Hand over history; the model is built on first use
+void add_command_sequence(const char *prev, const char *current); // Add command to history; 'prev' may be NULL
 char **get_command_suggestions(const char *prev_command, int *count); // Get suggestions
-void free_ai_suggest();                         // Free AI resources
+void start_suggestion_worker();                  // Compute suggestions off the prompt path
+void request_command_suggestions(const char *prev_command);
+int take_command_suggestions(int timeout_ms, char ***suggestions, int *count);
+void cancel_command_suggestions();
+char **suggest_command_corrections(const char *name, int *count); // Typo fixes
+void free_ai_suggest();                         // Free AI resources (on shutdown)
+void checkpoint_ai_suggest(int force);          // Persist the trained model
+int for_each_command_context(void (*visit)(const char *dir)); // -1 until the model is built
 
 // Phase 2: External AI Integration (for future implementation)
 typedef enum {
@@ -57,17 +169,88 @@ int enable_llm_integration(const char *api_key);
 void disable_llm_integration();
 
 // Built-in command functions
-void builtin_cd(Command *cmd);
-void builtin_pwd();
-void builtin_echo(Command *cmd);
-void builtin_pinfo(Command *cmd);
-void builtin_setenv(Command *cmd);
-void builtin_unsetenv(Command *cmd);
-void builtin_help(Command *cmd);
+int builtin_cd(Command *cmd);
+int builtin_pwd(Command *cmd);
+int builtin_echo(Command *cmd);
+int builtin_pinfo(Command *cmd);
+int pinfo_watches(const Command *cmd);
+int builtin_setenv(Command *cmd);
+int builtin_unsetenv(Command *cmd);
+int builtin_help(Command *cmd);
+int builtin_hash(Command *cmd);
+int builtin_rehash(Command *cmd);
+int builtin_shopt(Command *cmd);
+int builtin_exit(Command *cmd);
+int builtin_jobs(Command *cmd);
+int builtin_fg(Command *cmd);
+int builtin_bg(Command *cmd);
+int builtin_wait(Command *cmd);
+int builtin_z(Command *cmd);
+int change_directory(const char *path);          // cd without the argument handling
+
+// Job control
+typedef struct Job Job;
+
+void init_job_control(int interactive);
+int job_control_enabled();
+Job *job_create(const char *command, int foreground);
+void job_add_process(Job *job, pid_t pid, StageUsage *report);
+int job_process_count(Job *job);
+void job_discard(Job *job);
+pid_t job_launch_pgid(Job *job);               // -1 without job control
+int job_takes_terminal(Job *job);              // Next process gets the terminal
+int job_terminal_fd();
+int job_wakeup_fd();                           // Readable when a child changed state
+int job_stopped(Job *job);
+void job_child_setup(pid_t pgid, int foreground);
+void job_spawn_attributes(posix_spawnattr_t *attr, pid_t pgid);
+int job_foreground(Job *job, int cont);        // Wait; returns exit status
+void job_background(Job *job, int cont);
+void reap_jobs();                              // Collect finished children
+void notify_jobs();                            // Report finished jobs
+void reset_jobs_in_subshell();
+void free_jobs();
+
+// Non-interactive mode: -c, script files and piped input
+int run_script_mode(int argc, char *argv[]);
+
+// Executable lookup cache for $PATH
+const char *path_cache_lookup(const char *name);       // Absolute path or NULL
+const char *path_cache_complete(const char *prefix, int index);
+
+// Filename completion (completion.c)
+char *complete_filename(const char *text, int state);   // Readline generator
+void free_completion_cache();
+void path_cache_rehash();
+int path_cache_print(const char *name);
+void free_path_cache();
+
+// Frecency-ranked directories for z and j (frecency.c)
+#define FRECENCY_CD_WEIGHT 1.0          // Entering a directory
+#define FRECENCY_COMMAND_WEIGHT 0.25    // Running a command line in it
+void init_frecency(int interactive);
+int frecency_active();                                    // Visits are being recorded
+void frecency_visit(const char *dir, double weight);      // NULL: the working directory
+const char *frecency_best(char *const *words, int count); // Best match, or NULL
+char *frecency_completion(const char *text, int state);   // Readline generator
+void save_frecency_index(int force);
+void free_frecency();
+
+// String interning: each distinct string is stored once and named by an id
+typedef uint32_t StringId;
+#define NO_STRING ((StringId)-1)
+
+StringId intern_string(const char *str);         // Find or add a string
+StringId intern_lookup(const char *str);         // Find only, NO_STRING if absent
+const char *interned_string(StringId id);
+uint32_t interned_count();
+uint32_t interned_hash(StringId id);
+int intern_adopt(const char *data, const uint32_t *offsets, const uint32_t *hashes,
+                 uint32_t count, void *mapping, size_t mapping_size);
+void free_interned_strings();
 
 // Helper functions
-void free_pipeline(Pipeline *pipeline);
-void free_command(Command *cmd);
+void free_command_line(CommandLine *line);
 char *get_absolute_path(const char *path);
 
 #endif // SHELL_H 
\ No newline at end of file